@@ -5,10 +5,18 @@
 #include <iostream>
 #include <stdexcept>
 
-#include "trace.h"
+#include "trace-open.h"
+#include "trace-prefetch.h"
+#include "trace-stage.h"
+#include "trace-merge.h"
 #include "model-offline.h"
 #include "model-online.h"
 #include "model-hash.h"
+#include "hash-report.h"
+#include "model-p4.h"
+#include "model-dleft.h"
+#include "model-sharded.h"
+#include "model-sweep.h"
 
 using namespace std;
 
@@ -27,19 +35,39 @@ struct tArgs {
     unsigned injectnum = 1;
     unsigned injectden = 1;
     const char *injectfile = nullptr;
+    const char *eventfile = nullptr;
+    const char *p4config = nullptr;
+    const char *digestfile = nullptr;
+    const char *dleftconfig = nullptr;
+    const char *grid = nullptr;
+    const char *sweepprefix = "sweep";
     uint64_t threshold = 10000;
+    bool manualthreshold = false;
     uint64_t speed = 0;
     uint64_t divider = 0;
     uint64_t memory = 0;
     double quotient = 0.0;
     unsigned firstlen = 1;
     unsigned colstrategy = 2;
+    unsigned prefetch = PREFETCH_SLOTS;
+    unsigned threads = 0;
+    unsigned precision = 0;
+    vector<int> cpus;
     bool help = false;
     bool offline = false;
     bool firstshot = false;
     bool pureheavy = false;
     bool origdata = false;
     bool reports = false;
+    bool merge = false;
+    bool trie = false;
+    bool blockedfilter = false;
+    bool hashreport = false;
+    bool compact = false;
+    tHashFamily hashfamily = HASH_STD;
+    size_t filterslots = FLOW_FILTER_LIMIT;
+    bool asyncreport = false;
+    bool pipeline = false;
     bool newinvalidation = true;
     bool collapseacc = false;
     double filter_false_positive_probability = 0.1;
@@ -51,7 +79,7 @@ struct tArgs {
 };
 
 inline void tArgs::usage() {
-    cout << "Usage: " << __progname << " [-hoAHRfSrvpF] [-c COLSTR] [-b BFSIZE] [-B BFPROB] [-e BFELEMS] [-x RPLEN] [-m MEMORY] [-a ATIMEOUT] [-i ITIMEOUT] [-O OFFSET] [-q QUOTIENT] [-d DIVIDER] [-s SPEED] [-t THRESHOLD] [-I INJECTFILE] [-T INJECTTIME] [-S INJECTSAMP] PDAT_FILES ..." << endl;
+    cout << "Usage: " << __progname << " [-hoAHRfSrvpFwuMLGYC] [-c COLSTR] [-y HASHFAMILY] [-E P4CONFIG] [-Q DIGESTFILE] [-J DLEFTCONFIG] [-b BFSIZE] [-K FLOWSLOTS] [-B BFPROB] [-e BFELEMS] [-x RPLEN] [-P SLOTS] [-U CPUS] [-j THREADS] [-g GRID] [-l PRECISION] [-k SWEEPPREFIX] [-m MEMORY] [-a ATIMEOUT] [-i ITIMEOUT] [-O OFFSET] [-q QUOTIENT] [-d DIVIDER] [-s SPEED] [-t THRESHOLD] [-W EVENTFILE] [-I INJECTFILE] [-T INJECTTIME] [-N INJECTNUM] [-D INJECTDEN] PDAT_FILES ..." << endl;
     cout << "  -h            Show this help message." << endl;
     cout << "  -H            Print pure heavy-hitters too." << endl;
     cout << "  -A            Accelerate collapsing of the prefix tree." << endl;
@@ -59,15 +87,30 @@ inline void tArgs::usage() {
     cout << "  -S            Stop after first window report (only for offline analysis)." << endl;
     cout << "  -p            Use number of packets instead of number of bytes." << endl;
     cout << "  -F            Use number of flows instead of number of packets or bytes." << endl;
+    cout << "  -l PRECISION  Count distinct flows by HyperLogLog sketches of 2^PRECISION registers (4-16, offline only, 0 counts exactly)." << endl;
     cout << "  -o            Use original PCAP as input instead extracted data only." << endl;
     cout << "  -v            Turn off the new memory access efficient approach to invalidation." << endl;
     cout << "  -r            Report all changes in the prefix tree structure." << endl;
-    cout << "  -c COLSTR     Collisions strategy (0-ignore, 1-skip, 2-adapt-bit, 3-adapt-full, only for -m option)." << endl;
+    cout << "  -M            Merge PDAT_FILES by time, each given as FILE[:SHIFT[:N]] (shift in usec, 1-in-N sampling)." << endl;
+    cout << "  -L            Look up prefixes in a multibit trie (online model only)." << endl;
+    cout << "  -w            Write reports by a background thread." << endl;
+    cout << "  -c COLSTR     Collisions strategy (0-ignore, 1-skip, 2-adapt-bit, 3-adapt-full, 4-buckets, only for -m option)." << endl;
     cout << "  -R REPGRAN    Reports granularity in usec." << endl;
     cout << "  -b BFSIZE     Bloom filter maximum size (in bits for a single stage)." << endl;
     cout << "  -B BFPROB     Bloom filter false positive probability." << endl;
     cout << "  -e BFELEMS    Bloom filter projected elements." << endl;
+    cout << "  -G            Use cache-line blocked Bloom filters (only for -m option)." << endl;
+    cout << "  -C            Use compact registers of switch widths for hash tables (only for -m option)." << endl;
+    cout << "  -y HASHFAMILY Hash family of the tables (std, crc32, crc32c, mulshift, tabulation, only for -m option)." << endl;
+    cout << "  -Y            Report collisions of all hash families over source addresses instead (only for -m option)." << endl;
+    cout << "  -K FLOWSLOTS  Flows filter slots per level before it becomes approximate (only for online model)." << endl;
     cout << "  -x RPLEN      Root prefix length (eg. 1 or 16, 1 is default)." << endl;
+    cout << "  -P SLOTS      Batches read ahead by a background thread (0 turns read-ahead off)." << endl;
+    cout << "  -u            Run reading, merging, model and report as pipeline stages connected by lock-free rings." << endl;
+    cout << "  -U CPUS       Pin the pipeline stages to the comma separated cores: model, report, merge, then inputs (implies -u)." << endl;
+    cout << "  -j THREADS    Run online models in threads partitioned by the root prefix (see -x, not with -m or -F), or set sweep workers and offline reduce threads." << endl;
+    cout << "  -g GRID       Sweep online or hash models over a grid like t=10000,20000:m=0,4096:c=0,2:d=0,4 in one pass." << endl;
+    cout << "  -k SWEEPPREFIX Prefix of the output files of sweep configurations (default sweep)." << endl;
     cout << "  -m MEMORY     Use hash based table for evaluation and set available memory." << endl;
     cout << "  -d DIVIDER    Use adaptive time window according the divider." << endl;
     cout << "  -a ATIMEOUT   Active timeout in usec (for periodic reports)." << endl;
@@ -76,6 +119,10 @@ inline void tArgs::usage() {
     cout << "  -q QUOTIENT   Set threshold according the quotient (fraction, offline only)." << endl;
     cout << "  -s SPEED      Set threshold according the speed (in bytes per second)." << endl;
     cout << "  -t THRESHOLD  Manual threshold settings for heavy hitter detection (in bytes)." << endl;
+    cout << "  -E P4CONFIG   Emulate the hhh.p4 switch with table entries and registers of the runtime CLI file, -t, -a and -i override its registers." << endl;
+    cout << "  -Q DIGESTFILE Write digests of the emulated switch as bmv2 notifications (only for -E option)." << endl;
+    cout << "  -J DLEFTCONFIG Emulate the dleft.p4 switch with table entries of the runtime CLI file." << endl;
+    cout << "  -W EVENTFILE  Write events as binary records to the file instead of text." << endl;
     cout << "  -I INJECTFILE PDAT file with traffic for injection." << endl;
     cout << "  -T INJECTTIME Time from the start of traffic in usecs where to inject specified file." << endl;
     cout << "  -N INJECTNUM  Sampling numerator of injected file." << endl;
@@ -84,7 +131,7 @@ inline void tArgs::usage() {
 
 tArgs::tArgs(int argc, char * const argv[]) {
 
-    for (int opt = 0; (opt = getopt(argc, argv, ":hHFN:D:R:Arc:ovb:e:O:B:I:T:x:m:d:fSpa:i:t:q:s:")) != -1; ) switch(opt) {
+    for (int opt = 0; (opt = getopt(argc, argv, ":hHFN:D:R:P:W:wuU:MLGYCy:E:Q:J:j:g:k:l:Arc:ovb:e:K:O:B:I:T:x:m:d:fSpa:i:t:q:s:")) != -1; ) switch(opt) {
         case 'h':
             help = true; return;
         case 'H':
@@ -103,6 +150,8 @@ tArgs::tArgs(int argc, char * const argv[]) {
             filter_false_positive_probability = strtod(optarg, nullptr); break;
         case 'e':
             filter_projected_element_count = strtod(optarg, nullptr); break;
+        case 'K':
+            filterslots = strtoull(optarg, nullptr, 10); break;
         case 'o':
             origdata = true; break;
         case 'S':
@@ -111,6 +160,54 @@ tArgs::tArgs(int argc, char * const argv[]) {
             offline = true; break;
         case 'r':
             reports = true; break;
+        case 'w':
+            asyncreport = true; break;
+        case 'M':
+            merge = true; break;
+        case 'L':
+            trie = true; break;
+        case 'G':
+            blockedfilter = true; break;
+        case 'Y':
+            hashreport = true; break;
+        case 'C':
+            compact = true; break;
+        case 'y':
+            hashfamily = tHash::family(optarg); break;
+        case 'W':
+            eventfile = optarg; break;
+        case 'E':
+            p4config = optarg; break;
+        case 'Q':
+            digestfile = optarg; break;
+        case 'J':
+            dleftconfig = optarg; break;
+        case 'u':
+            pipeline = true; break;
+        case 'U':
+            pipeline = true;
+            for (const char *cpu = optarg; *cpu != '\0'; cpu++) {
+                char *end;
+                cpus.push_back(strtol(cpu, &end, 10));
+                if (end == cpu || (*end != ',' && *end != '\0')) throw runtime_error(string("invalid core list '") + optarg + "'");
+                if (*(cpu = end) == '\0') break;
+            }
+            break;
+        case 'P':
+            prefetch = strtoul(optarg, nullptr, 10); break;
+        case 'j':
+            threads = strtoul(optarg, nullptr, 10);
+            if (threads < 1) threads = 1;
+            break;
+        case 'l':
+            precision = strtoul(optarg, nullptr, 10);
+            if (precision != 0 && (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION))
+                throw runtime_error("invalid HyperLogLog precision '" + string(optarg) + "'");
+            break;
+        case 'g':
+            grid = optarg; break;
+        case 'k':
+            sweepprefix = optarg; break;
         case 'm':
             memory = strtoul(optarg, nullptr, 10); break;
         case 'x':
@@ -130,7 +227,9 @@ tArgs::tArgs(int argc, char * const argv[]) {
         case 'i':
             itimeout = strtoul(optarg, nullptr, 10); break;
         case 't':
-            threshold = strtoul(optarg, nullptr, 10); break;
+            threshold = strtoul(optarg, nullptr, 10);
+            manualthreshold = true;
+            break;
         case 's':
             speed = strtoul(optarg, nullptr, 10); break;
         case 'q':
@@ -152,6 +251,170 @@ tArgs::tArgs(int argc, char * const argv[]) {
     filenames = argv; filecount = argc;
 }
 
+// Pipeline stages in the order of cores given by -U, inputs are the last
+enum tStage {
+    STAGE_MODEL,
+    STAGE_REPORT,
+    STAGE_MERGE,
+    STAGE_INPUT
+};
+
+// Core of the pipeline stage, negative when it is not pinned
+int stageCpu(const tArgs &args, unsigned stage) {
+    return (stage < args.cpus.size()) ? args.cpus[stage] : -1;
+}
+
+// Opens an input trace, read ahead by a background thread unless turned off,
+// or by a pipeline stage of the input index
+tTrace *openInput(const tArgs &args, const char *filename, unsigned idx = 0) {
+    tTrace *trace = openTrace(filename, args.origdata);
+    if (args.pipeline) trace = new tTraceStage(trace, "input" + to_string(idx), STAGE_SLOTS, stageCpu(args, STAGE_INPUT + idx));
+    else if (args.prefetch > 0) trace = new tTracePrefetch(trace, args.prefetch);
+    return trace;
+}
+
+// Opens all inputs as a single merged trace, injection is a rebased input;
+// without -M the files are read one after another as a single input
+tTrace *openMerge(const tArgs &args, tReport &report, tTraceMerge *&merged) {
+    unique_ptr<tTraceMerge> merge(new tTraceMerge());
+    merged = merge.get();
+    merge->offset = args.offset;
+    unsigned inputs = 0;
+
+    if (args.injectfile != nullptr) {
+        report.text() << "injectfile: " << args.injectfile << endl;
+        tMergeInput input;
+        input.trace = openInput(args, args.injectfile, inputs++);
+        input.shift = args.injecttime;
+        input.rebase = true;
+        input.primary = false;
+        input.num = args.injectnum;
+        input.den = args.injectden;
+        merge->add(input);
+    }
+
+    if (!args.merge) {
+        tMergeInput input;
+        for (unsigned f = 0; f < args.filecount; f++) report.text() << "filename: " << args.filenames[f] << endl;
+        input.trace = new tTraceChain(args.filecount, [&args, inputs](unsigned f) -> tTrace * {
+            return openInput(args, args.filenames[f], inputs + f);
+        });
+        merge->add(input);
+    }
+
+    for (unsigned f = 0; args.merge && f < args.filecount; f++) {
+        string filename = args.filenames[f];
+        tMergeInput input;
+
+        // Parse optional shift and sampling of the file
+        size_t pos = filename.find(':');
+        if (args.merge && pos != string::npos && access(filename.c_str(), F_OK) != 0) {
+            char *end;
+            input.shift = strtoll(filename.c_str() + pos + 1, &end, 10);
+            if (*end == ':') input.den = strtoul(end + 1, &end, 10);
+            if (*end != '\0' || input.den < 1) throw runtime_error("invalid input specification '" + filename + "'");
+            filename.resize(pos);
+        }
+
+        report.text() << "filename: " << filename << endl;
+        input.trace = openInput(args, filename.c_str(), inputs++);
+        merge->add(input);
+    }
+    if (args.pipeline) return new tTraceStage(merge.release(), "merge", STAGE_SLOTS, stageCpu(args, STAGE_MERGE));
+    return merge.release();
+}
+
+// Hash model of the arguments reporting to the report
+tModelHash *newModelHash(const tArgs &args, tReport *report) {
+    tModelHash *hashmodel = new tModelHash();
+    hashmodel->report = report;
+    hashmodel->pureheavy = args.pureheavy;
+    hashmodel->threshold = args.threshold;
+    hashmodel->speed = args.speed;
+    hashmodel->memory = args.memory;
+    hashmodel->atimeout = (args.atimeout > 0) ? args.atimeout : 10000000;
+    hashmodel->itimeout = (args.itimeout > 0) ? args.itimeout : 60000000;
+    hashmodel->bytes = !args.packets;
+    hashmodel->flows = args.flows;
+    hashmodel->reports = args.reports;
+    hashmodel->firstlen = args.firstlen;
+    hashmodel->lastlen = 32;
+    hashmodel->hashskip = args.colstrategy == 1;
+    hashmodel->hashcopt = args.colstrategy == 2;
+    hashmodel->hashadapt = args.colstrategy == 3;
+    hashmodel->hashbuckets = args.colstrategy == 4;
+    hashmodel->newinvalidation = args.newinvalidation;
+    hashmodel->collapseacc = args.collapseacc;
+    hashmodel->filter_maximum_size = args.filter_maximum_size;
+    hashmodel->filter_false_positive_probability = args.filter_false_positive_probability;
+    hashmodel->filter_projected_element_count = args.filter_projected_element_count;
+    hashmodel->blockedfilter = args.blockedfilter;
+    hashmodel->hashfamily = args.hashfamily;
+    hashmodel->compact = args.compact;
+    hashmodel->init(args.divider);
+    return hashmodel;
+}
+
+// Online model of the arguments reporting to the report
+tModelOnline *newModelOnline(const tArgs &args, tReport *report) {
+    tModelOnline *onmodel = new tModelOnline();
+    onmodel->report = report;
+    onmodel->pureheavy = args.pureheavy;
+    onmodel->threshold = args.threshold;
+    onmodel->speed = args.speed;
+    onmodel->atimeout = (args.atimeout > 0) ? args.atimeout : 10000000;
+    onmodel->itimeout = (args.itimeout > 0) ? args.itimeout : 60000000;
+    onmodel->repgran = (args.repgran > 0) ? args.repgran : onmodel->atimeout;
+    onmodel->bytes = !args.packets;
+    onmodel->flows = args.flows;
+    onmodel->reports = args.reports;
+    onmodel->firstlen = args.firstlen;
+    onmodel->lastlen = 32;
+    onmodel->newinvalidation = args.newinvalidation;
+    onmodel->collapseacc = args.collapseacc;
+    onmodel->trie = args.trie;
+    onmodel->filterslots = args.filterslots;
+    onmodel->init(args.divider);
+    return onmodel;
+}
+
+// Configurations of the sweep grid with their labels, every combination of
+// the values of thresholds (t), memories (m), collision strategies (c) and
+// dividers (d); parameters out of the grid keep their arguments
+vector<pair<string,tArgs>> sweepConfigs(const tArgs &args) {
+    vector<pair<string,tArgs>> configs(1, make_pair(string(), args));
+    string grid = args.grid;
+    for (size_t pos = 0; pos <= grid.size(); ) {
+        size_t end = min(grid.find(':', pos), grid.size());
+        string item = grid.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.size() < 3 || item[1] != '=' || string("tmcd").find(item[0]) == string::npos)
+            throw runtime_error("invalid sweep grid '" + grid + "'");
+
+        vector<pair<string,tArgs>> combined;
+        for (const char *value = item.c_str() + 2; ; value++) {
+            char *vend;
+            uint64_t number = strtoull(value, &vend, 10);
+            if (vend == value || (*vend != ',' && *vend != '\0')) throw runtime_error("invalid sweep grid '" + grid + "'");
+            for (const auto &config: configs) {
+                combined.push_back(config);
+                tArgs &cargs = combined.back().second;
+                switch (item[0]) {
+                    case 't': cargs.threshold = number; break;
+                    case 'm': cargs.memory = number; break;
+                    case 'c': cargs.colstrategy = number; break;
+                    case 'd': cargs.divider = number; break;
+                }
+                string &label = combined.back().first;
+                label += (label.empty() ? "" : " ") + item.substr(0, 2) + to_string(number);
+            }
+            if (*(value = vend) == '\0') break;
+        }
+        configs.swap(combined);
+    }
+    return configs;
+}
+
 int main(int argc, char *argv[]) try {
 
     tArgs args(argc, argv);
@@ -159,9 +422,33 @@ int main(int argc, char *argv[]) try {
         args.usage(); return EXIT_SUCCESS;
     }
 
+    tReportMode mode = args.eventfile ? REPORT_BINARY : (args.asyncreport || args.pipeline) ? REPORT_ASYNC : REPORT_TEXT;
+    tReport report(cout, mode, args.eventfile);
+    if (stageCpu(args, STAGE_REPORT) >= 0) report.pin(stageCpu(args, STAGE_REPORT));
+    if (stageCpu(args, STAGE_MODEL) >= 0) pinThread(pthread_self(), stageCpu(args, STAGE_MODEL));
+
     tModel *model;
-    if (args.offline) {
+    if (args.p4config != nullptr) {
+        tModelP4 *p4model = new tModelP4();
+        p4model->report = &report;
+        p4model->digestfile = args.digestfile;
+        if (args.memory > 0) p4model->tabsize = max<uint64_t>(args.memory / HHH_TABCOUNT, 1);
+        p4model->cfg_threshold = args.threshold;
+        p4model->init(args.p4config);
+        // Values given on the command line override the register writes of the config file
+        if (args.manualthreshold) p4model->cfg_threshold = args.threshold;
+        if (args.atimeout > 0) p4model->cfg_timeouts[0] = args.atimeout & P4_TIME_MASK;
+        if (args.itimeout > 0) p4model->cfg_timeouts[1] = args.itimeout & P4_TIME_MASK;
+        model = p4model;
+    } else if (args.dleftconfig != nullptr) {
+        tModelDleft *dleftmodel = new tModelDleft();
+        dleftmodel->report = &report;
+        if (args.memory > 0) dleftmodel->tabsize = max<uint64_t>(args.memory / HHH_TABCOUNT, 1);
+        dleftmodel->init(args.dleftconfig);
+        model = dleftmodel;
+    } else if (args.offline) {
         tModelOffline *offmodel = new tModelOffline();
+        offmodel->report = &report;
         offmodel->pureheavy = args.pureheavy;
         offmodel->threshold = (args.speed > 0) ? args.speed * args.atimeout / 1000000 : args.threshold;
         offmodel->quotient = args.quotient;
@@ -173,47 +460,53 @@ int main(int argc, char *argv[]) try {
         offmodel->collapseacc = args.collapseacc;
         offmodel->firstlen = args.firstlen;
         offmodel->lastlen = 32;
+        offmodel->threads = max(args.threads, 1U);
+        offmodel->precision = args.precision;
         model = offmodel;
+    } else if (args.grid != nullptr) {
+        tModelSweep *sweepmodel = new tModelSweep(args.threads > 0 ? args.threads : thread::hardware_concurrency());
+        sweepmodel->report = &report;
+        for (const auto &config: sweepConfigs(args)) {
+            string filename = string(args.sweepprefix) + "-";
+            for (char c: config.first) filename += (c == ' ') ? '-' : (c == '=') ? '_' : c;
+            const tArgs &cargs = config.second;
+            sweepmodel->add(config.first, filename + ".txt", [&cargs](tReport *cfgreport) -> tModel * {
+                if (cargs.memory > 0) return newModelHash(cargs, cfgreport);
+                return newModelOnline(cargs, cfgreport);
+            });
+        }
+        sweepmodel->start();
+        model = sweepmodel;
+    } else if (args.threads > 1 && !args.hashreport) {
+        // Hash tables and flow filter windows are shared by all prefixes,
+        // shards of their own would not give the results of a single model
+        if (args.memory > 0 || args.flows)
+            throw runtime_error("threads (-j) can not be combined with hash tables (-m) or flows (-F)");
+        if (args.firstlen < 32 && (1UL << args.firstlen) < args.threads)
+            cerr << __progname << ": warning: " << (1UL << args.firstlen) << " root prefixes keep at most as many of "
+                << args.threads << " threads busy, raise -x" << endl;
+        tModelSharded::tFactory factory = [&args](tReport *shardreport) -> tModel * {
+            return newModelOnline(args, shardreport);
+        };
+        model = new tModelSharded(args.threads, args.firstlen, factory);
+        model->report = &report;
     } else if (args.memory > 0) {
-        tModelHash *hashmodel = new tModelHash();
-        hashmodel->pureheavy = args.pureheavy;
-        hashmodel->threshold = args.threshold;
-        hashmodel->speed = args.speed;
-        hashmodel->memory = args.memory;
-        hashmodel->atimeout = (args.atimeout > 0) ? args.atimeout : 10000000;
-        hashmodel->itimeout = (args.itimeout > 0) ? args.itimeout : 60000000;
-        hashmodel->bytes = !args.packets;
-        hashmodel->flows = args.flows;
-        hashmodel->reports = args.reports;
-        hashmodel->firstlen = args.firstlen;
-        hashmodel->lastlen = 32;
-        hashmodel->hashskip = args.colstrategy == 1;
-        hashmodel->hashcopt = args.colstrategy == 2;
-        hashmodel->hashadapt = args.colstrategy == 3;
-        hashmodel->newinvalidation = args.newinvalidation;
-        hashmodel->collapseacc = args.collapseacc;
-        hashmodel->filter_maximum_size = args.filter_maximum_size;
-        hashmodel->filter_false_positive_probability = args.filter_false_positive_probability;
-        hashmodel->filter_projected_element_count = args.filter_projected_element_count;
-        hashmodel->init(args.divider);
+        tModelHash *hashmodel = newModelHash(args, &report);
         model = hashmodel;
+
+        // Table sizes of the hash model are used for the collision report
+        if (args.hashreport) {
+            tModelHashReport *hashreport = new tModelHashReport();
+            hashreport->report = &report;
+            hashreport->firstlen = hashmodel->firstlen;
+            hashreport->lastlen = hashmodel->lastlen;
+            for (unsigned len = hashmodel->firstlen; len <= hashmodel->lastlen; len++)
+                hashreport->memsizes.push_back(hashmodel->getMemsize(len));
+            delete hashmodel;
+            model = hashreport;
+        }
     } else {
-        tModelOnline *onmodel = new tModelOnline();
-        onmodel->pureheavy = args.pureheavy;
-        onmodel->threshold = args.threshold;
-        onmodel->speed = args.speed;
-        onmodel->atimeout = (args.atimeout > 0) ? args.atimeout : 10000000;
-        onmodel->itimeout = (args.itimeout > 0) ? args.itimeout : 60000000;
-        onmodel->repgran = (args.repgran > 0) ? args.repgran : onmodel->atimeout;
-        onmodel->bytes = !args.packets;
-        onmodel->flows = args.flows;
-        onmodel->reports = args.reports;
-        onmodel->firstlen = args.firstlen;
-        onmodel->lastlen = 32;
-        onmodel->newinvalidation = args.newinvalidation;
-        onmodel->collapseacc = args.collapseacc;
-        onmodel->init(args.divider);
-        model = onmodel;
+        model = newModelOnline(args, &report);
     }
 
     tPacket pkt;
@@ -222,134 +515,61 @@ int main(int argc, char *argv[]) try {
     uint64_t start = 0;
     uint64_t ostart = 0;
 
-    tPacket injpkt;
-    uint64_t injPcktsCount = 0;
-    uint64_t injBytesCount = 0;
-    uint64_t injStart = 0;
-    uint32_t injSampl = args.injectden;
+    // Merged inputs and injection make a single trace, otherwise files are
+    // read one by one
+    bool merge = args.merge || args.injectfile != nullptr;
+    unsigned traces = merge ? 1 : args.filecount;
 
-    tTrace *injTrace = nullptr;
-    if (args.injectfile != nullptr) {
-        if (!args.origdata) {
-            injTrace = new tTraceData(args.injectfile);
-        } else {
-#ifndef NOPCAP
-            injTrace = new tTraceFile(args.injectfile);
-#else
-            assert(false && "Compiled without PCAP support");
-#endif
-        }
+    for (unsigned f = 0; f < traces; f++) {
 
-        while (true) {
-            if (injTrace->nextPacket(injpkt)) {
-                cout << "TRUE: " << injSampl << endl;
-
-                if (injpkt.ipver != 4) continue; // TODO: IPv6 support
-                injStart = injpkt.timestamp;
-                cout << "injstart: " << injStart << endl;
-
-                break;
-            } else {
-                cout << "FALSE" << endl;
-
-                delete injTrace;
-                injTrace = nullptr;
-                break;
-            }
-        }
-    }
-
-    for (unsigned f = 0; f < args.filecount; f++) {
-
-        tTrace *trace = nullptr;
-        cout << "filename: " << args.filenames[f] << endl;
-        if (!args.origdata) {
-            trace = new tTraceData(args.filenames[f]);
+        tTrace *trace;
+        tTraceMerge *merged = nullptr;
+        if (merge) {
+            trace = openMerge(args, report, merged);
         } else {
-#ifndef NOPCAP
-            trace = new tTraceFile(args.filenames[f]);
-#else
-            assert(false && "Compiled without PCAP support");
-#endif
+            report.text() << "filename: " << args.filenames[f] << endl;
+            trace = openInput(args, args.filenames[f]);
         }
+        if (start != 0 && args.offset > 0) trace->seek(ostart);
 
-        while (trace->nextPacket(pkt)) {
+        tBatch batch;
+        bool stop = false;
+        while (!stop && trace->nextBatch(batch)) for (const tPacket &bpkt: batch) {
+            pkt = bpkt;
             if (pkt.ipver != 4) continue; // TODO: IPv6 support
 
             if (start == 0) {
-                start = pkt.timestamp;
-                ostart = pkt.timestamp + args.offset;
-                cout << "tracestart: " << start << endl;
-                cout << "offsetstart: " << ostart << endl;
-            }
+                start = merged ? merged->start() : pkt.timestamp;
+                ostart = start + args.offset;
+                report.text() << "tracestart: " << start << endl;
+                report.text() << "offsetstart: " << ostart << endl;
 
-            // Skip offset time from the beginning of the trace
-            if (ostart > pkt.timestamp) continue;
-
-//            cout << injpkt.srcPrefix.str() << endl;
-//            cout << injpkt.dstPrefix.str() << endl;
-//            cout << injpkt.length << endl;
-//            cout << injpkt.ipver << endl;
-//            cout << injpkt.timestamp << "(" << injpkt.timestamp-injStart+args.injecttime << ")" << endl;
-//            cout << endl;
-//
-//            cout << pkt.srcPrefix.str() << endl;
-//            cout << pkt.dstPrefix.str() << endl;
-//            cout << pkt.length << endl;
-//            cout << pkt.ipver << endl;
-//            cout << pkt.timestamp << "(" << pkt.timestamp-start << ")" << endl;
-//            cout << endl;
-//
-//            cout << "---" << endl;
-
-
-            if (injTrace != nullptr) {
-                while (pkt.timestamp-start >= injpkt.timestamp-injStart+args.injecttime) {
-
-                    pcktsCount += 1;
-                    bytesCount += injpkt.length;
-
-                    injPcktsCount += 1;
-                    injBytesCount += injpkt.length;
-
-                    injpkt.timestamp = injpkt.timestamp-injStart+args.injecttime+start;
-
-                    model->processPacket(injpkt);
-
-                    while (true) {
-                        if (injSampl == 0)
-                            injSampl = args.injectden;
-
-                        if (injTrace->nextPacket(injpkt)) {
-                            if (injpkt.ipver != 4) continue; // TODO: IPv6 support
-                            if (--injSampl >= args.injectnum) continue;
-                            break;
-                        } else {
-                            delete injTrace;
-                            injTrace = nullptr;
-                            break;
-                        }
-                    }
-
-                }
+                // Jump over the offset time if the trace is indexed
+                if (args.offset > 0 && !merge && trace->seek(ostart)) break;
             }
 
+            // Skip offset time from the beginning of the trace, merged traces
+            // skip it themselves and keep the injected packets
+            if (ostart > pkt.timestamp && !merge) continue;
+
             pcktsCount += 1;
             bytesCount += pkt.length;
 
-            if (!model->processPacket(pkt)) break;
+            if (!model->processPacket(pkt)) { stop = true; break; }
         }
 
+        trace->stats(report.text());
         delete trace;
         trace = nullptr;
     }
 
     model->flush();
+    if (args.pipeline) report.text() << "stage-report: " << report.stalls() << " stalls" << endl;
 
     delete model;
     model = nullptr;
 
-    cout << endl << pcktsCount << " packets, " << bytesCount << " bytes processed." << endl;
+    report.text() << endl << pcktsCount << " packets, " << bytesCount << " bytes processed." << endl;
 
 } catch(exception &e) {
     cerr << __progname << ": " << e.what() << endl;
@@ -0,0 +1,162 @@
+#ifndef BLOOM_BLOCKED_H_
+#define BLOOM_BLOCKED_H_
+
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "bloom-filter.h"
+
+using namespace std;
+
+const unsigned BLOOM_WORDS = 16;
+
+// Blocked Bloom filter, all bits of a key are in a single cache line of
+// sixteen 32-bit words, one bit in each of the first k words; fixed-size
+// POD keys are hashed by a 64-bit multiply-mix. Blocks are tagged by an
+// epoch and allocated by the first insertion like tBloomEpoch. Probes use
+// AVX2 when compiled with it.
+class tBloomBlocked {
+    public:
+        tBloomBlocked(const bloom_parameters &params);
+        tBloomBlocked(const tBloomBlocked &filter) { *this = filter; }
+        tBloomBlocked &operator=(const tBloomBlocked &filter);
+        template<typename T> inline void insert(const T &key);
+        template<typename T> inline bool contains(const T &key) const;
+        inline void clear() { _epoch++; }
+        unsigned long long size() const { return _blocks * BLOOM_WORDS * 32; }
+
+    private:
+        struct tBlock {
+            uint32_t words[BLOOM_WORDS];
+        };
+
+        struct tFree {
+            void operator()(tBlock *ptr) const { free(ptr); }
+        };
+
+        static const uint32_t SALTS[BLOOM_WORDS];
+
+        uint64_t _seed;
+        unsigned _hashes;
+        size_t _blocks;
+        uint32_t _epoch = 1;
+        unique_ptr<tBlock[],tFree> _bits;
+        unique_ptr<uint32_t[]> _tags;
+
+        void _alloc();
+        template<typename T> inline uint64_t _hash(const T &key) const;
+};
+
+const uint32_t tBloomBlocked::SALTS[BLOOM_WORDS] = {
+    0x47B6137B, 0x44974D91, 0x8824AD5B, 0xA2B7289D,
+    0x705495C7, 0x2DF1424B, 0x9EFC4947, 0x5C6BFB31,
+    0x1A3C8E6D, 0xC1E6A2B3, 0x6F4E2D15, 0xB3A1F08B,
+    0x8D5F3C27, 0x3E9B71A9, 0xD2C4B5E1, 0x7A0D9F43
+};
+
+tBloomBlocked::tBloomBlocked(const bloom_parameters &params) {
+    _seed = params.random_seed;
+    _hashes = params.optimal_parameters.number_of_hashes;
+    if (_hashes < 1) _hashes = 1;
+    if (_hashes > BLOOM_WORDS) _hashes = BLOOM_WORDS;
+    _blocks = (params.optimal_parameters.table_size + BLOOM_WORDS * 32 - 1) / (BLOOM_WORDS * 32);
+    if (_blocks < 1) _blocks = 1;
+}
+
+tBloomBlocked &tBloomBlocked::operator=(const tBloomBlocked &filter) {
+    if (this == &filter) return *this;
+    _seed = filter._seed;
+    _hashes = filter._hashes;
+    _blocks = filter._blocks;
+    _epoch = filter._epoch;
+    _bits.reset();
+    _tags.reset();
+
+    if (!filter._bits) return *this;
+    _alloc();
+    memcpy(_bits.get(), filter._bits.get(), _blocks * sizeof(tBlock));
+    memcpy(_tags.get(), filter._tags.get(), _blocks * sizeof(uint32_t));
+    return *this;
+}
+
+// Blocks are aligned to cache lines, tags start in no epoch
+void tBloomBlocked::_alloc() {
+    void *ptr;
+    if (posix_memalign(&ptr, sizeof(tBlock), _blocks * sizeof(tBlock)) != 0) throw bad_alloc();
+    _bits.reset(static_cast<tBlock *>(ptr));
+    _tags.reset(new uint32_t[_blocks]());
+}
+
+// Folds the key by 8-byte words, finished by the MurmurHash3 mixer
+template<typename T>
+inline uint64_t tBloomBlocked::_hash(const T &key) const {
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(&key);
+    uint64_t hash = _seed ^ (sizeof(T) * 0x9E3779B97F4A7C15UL);
+    for (size_t pos = 0; pos < sizeof(T); pos += 8) {
+        uint64_t word = 0;
+        memcpy(&word, data + pos, min<size_t>(8, sizeof(T) - pos));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15UL;
+        hash ^= hash >> 32;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDUL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53UL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+template<typename T>
+inline void tBloomBlocked::insert(const T &key) {
+    if (!_bits) _alloc();
+
+    uint64_t hash = _hash(key);
+    size_t idx = ((hash >> 32) * _blocks) >> 32;
+    tBlock &block = _bits[idx];
+    if (_tags[idx] != _epoch) {
+        memset(&block, 0, sizeof(tBlock));
+        _tags[idx] = _epoch;
+    }
+
+    for (unsigned i = 0; i < _hashes; i++)
+        block.words[i] |= 1U << (((uint32_t) hash * SALTS[i]) >> 27);
+}
+
+template<typename T>
+inline bool tBloomBlocked::contains(const T &key) const {
+    if (!_bits) return false;
+
+    uint64_t hash = _hash(key);
+    size_t idx = ((hash >> 32) * _blocks) >> 32;
+    if (_tags[idx] != _epoch) return false;
+    const tBlock &block = _bits[idx];
+
+#ifdef __AVX2__
+    __m256i hashes = _mm256_set1_epi32(hash);
+    __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i count = _mm256_set1_epi32(_hashes);
+    __m256i ones = _mm256_set1_epi32(1);
+    for (unsigned half = 0; half < _hashes; half += 8) {
+        __m256i salts = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(SALTS + half));
+        __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(hashes, salts), 27);
+        __m256i mask = _mm256_sllv_epi32(ones, bits);
+        __m256i used = _mm256_cmpgt_epi32(count, _mm256_add_epi32(lanes, _mm256_set1_epi32(half)));
+        __m256i words = _mm256_load_si256(reinterpret_cast<const __m256i *>(block.words + half));
+        if (!_mm256_testc_si256(words, _mm256_and_si256(mask, used))) return false;
+    }
+    return true;
+#else
+    for (unsigned i = 0; i < _hashes; i++)
+        if ((block.words[i] & (1U << (((uint32_t) hash * SALTS[i]) >> 27))) == 0) return false;
+    return true;
+#endif
+}
+
+#endif
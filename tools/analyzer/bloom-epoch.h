@@ -0,0 +1,99 @@
+#ifndef BLOOM_EPOCH_H_
+#define BLOOM_EPOCH_H_
+
+#include <memory>
+#include <cstring>
+#include <cstdint>
+
+#include "bloom-filter.h"
+
+using namespace std;
+
+const size_t BLOOM_BLOCK = 64;
+
+// Bloom filter hashing keys like bloom_filter, with its bit table allocated
+// by the first insertion and split into blocks tagged by an epoch; a block
+// of an older epoch reads as empty and is zeroed by its next write, so
+// clearing just advances the epoch
+class tBloomEpoch : protected bloom_filter {
+    public:
+        tBloomEpoch(const bloom_parameters &params);
+        tBloomEpoch(const tBloomEpoch &filter) { *this = filter; }
+        tBloomEpoch &operator=(const tBloomEpoch &filter);
+        template<typename T> inline void insert(const T &key);
+        template<typename T> inline bool contains(const T &key) const;
+        inline void clear() { _epoch++; }
+        using bloom_filter::size;
+
+    private:
+        size_t _blocks;
+        uint32_t _epoch = 1;
+        unique_ptr<unsigned char[]> _bits;
+        unique_ptr<uint32_t[]> _tags;
+};
+
+tBloomEpoch::tBloomEpoch(const bloom_parameters &params) {
+    projected_element_count_ = params.projected_element_count;
+    random_seed_ = (params.random_seed * 0xA5A5A5A5) + 1;
+    desired_false_positive_probability_ = params.false_positive_probability;
+    salt_count_ = params.optimal_parameters.number_of_hashes;
+    table_size_ = params.optimal_parameters.table_size;
+    generate_unique_salt();
+
+    size_t bytes = (table_size_ + bits_per_char - 1) / bits_per_char;
+    _blocks = (bytes + BLOOM_BLOCK - 1) / BLOOM_BLOCK;
+}
+
+tBloomEpoch &tBloomEpoch::operator=(const tBloomEpoch &filter) {
+    if (this == &filter) return *this;
+    bloom_filter::operator=(filter);
+    _blocks = filter._blocks;
+    _epoch = filter._epoch;
+    _bits.reset();
+    _tags.reset();
+
+    if (!filter._bits) return *this;
+    _bits.reset(new unsigned char[_blocks * BLOOM_BLOCK]);
+    _tags.reset(new uint32_t[_blocks]);
+    memcpy(_bits.get(), filter._bits.get(), _blocks * BLOOM_BLOCK);
+    memcpy(_tags.get(), filter._tags.get(), _blocks * sizeof(uint32_t));
+    return *this;
+}
+
+template<typename T>
+inline void tBloomEpoch::insert(const T &key) {
+    if (!_bits) {
+        _bits.reset(new unsigned char[_blocks * BLOOM_BLOCK]);
+        _tags.reset(new uint32_t[_blocks]());
+    }
+
+    for (size_t i = 0; i < salt_.size(); i++) {
+        size_t index, bit;
+        compute_indices(hash_ap(reinterpret_cast<const unsigned char *>(&key), sizeof(T), salt_[i]), index, bit);
+        index /= bits_per_char;
+
+        uint32_t &tag = _tags[index / BLOOM_BLOCK];
+        if (tag != _epoch) {
+            memset(&_bits[index - index % BLOOM_BLOCK], 0, BLOOM_BLOCK);
+            tag = _epoch;
+        }
+        _bits[index] |= bit_mask[bit];
+    }
+}
+
+template<typename T>
+inline bool tBloomEpoch::contains(const T &key) const {
+    if (!_bits) return false;
+
+    for (size_t i = 0; i < salt_.size(); i++) {
+        size_t index, bit;
+        compute_indices(hash_ap(reinterpret_cast<const unsigned char *>(&key), sizeof(T), salt_[i]), index, bit);
+        index /= bits_per_char;
+
+        if (_tags[index / BLOOM_BLOCK] != _epoch) return false;
+        if ((_bits[index] & bit_mask[bit]) == 0) return false;
+    }
+    return true;
+}
+
+#endif
@@ -1,11 +1,18 @@
 
+#include <mutex>
+#include <atomic>
 #include <string>
+#include <thread>
 #include <cstdlib>
 #include <unistd.h>
 #include <iostream>
 #include <stdexcept>
+#include <exception>
+#include <condition_variable>
 
 #include "trace.h"
+#include "trace-pcap.h"
+#include "trace-compact.h"
 
 using namespace std;
 
@@ -16,19 +23,33 @@ struct tArgs {
     inline void usage();
     char * const *filenames;
     unsigned filecount = 0;
+    unsigned threads = 1;
     bool help = false;
+    bool compact = false;
+    bool direct = false;
 };
 
 inline void tArgs::usage() {
-    cout << "Usage: " << __progname << " [-h] PCAP_FILES ..." << endl;
+    cout << "Usage: " << __progname << " [-hzd] [-j THREADS] PCAP_FILES ..." << endl;
     cout << "  -h            Show this help message." << endl;
+    cout << "  -j THREADS    Number of threads shared by input files and their chunks." << endl;
+    cout << "  -z            Write compressed columnar PDAT v2 format." << endl;
+    cout << "  -d            Write output with direct I/O, bypassing the page cache." << endl;
 }
 
 tArgs::tArgs(int argc, char * const argv[]) {
 
-    for (int opt = 0; (opt = getopt(argc, argv, ":h")) != -1; ) switch(opt) {
+    for (int opt = 0; (opt = getopt(argc, argv, ":hzdj:")) != -1; ) switch(opt) {
         case 'h':
             help = true; return;
+        case 'z':
+            compact = true; break;
+        case 'd':
+            direct = true; break;
+        case 'j':
+            threads = strtoul(optarg, nullptr, 10);
+            if (threads < 1) threads = 1;
+            break;
         case '?': throw runtime_error(string() + "unknown option '-" + (char) optopt + "'");
         case ':': throw runtime_error(string() + "missing argument for option '-" + (char) optopt + "'");
         default : throw runtime_error(string() + "option '-" + (char) opt + "' not implemented");
@@ -37,34 +58,176 @@ tArgs::tArgs(int argc, char * const argv[]) {
     filenames = argv; filecount = argc;
 }
 
-int main(int argc, char *argv[]) try {
+// Number of pcap records parsed by a single task
+const size_t CHUNK_RECORDS = 1 << 18;
 
-    tArgs args(argc, argv);
-    if (args.help) {
-        args.usage(); return EXIT_SUCCESS;
+struct tCounters {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t damaged = 0;
+};
+
+template<typename TWriter>
+void savePackets(TWriter &writer, const vector<tPacket> &packets, tCounters &counters) {
+    for (const tPacket &pkt: packets) {
+        if (pkt.ipver != 4) continue; // TODO: IPv6 support
+
+        counters.packets += 1;
+        counters.bytes += pkt.length;
+
+        writer.savePacket(pkt);
+    }
+}
+
+// Parses chunks of records concurrently and saves them in the original order
+template<typename TWriter>
+void convertPcap(const char *filename, TWriter &writer, unsigned threads, tCounters &counters) {
+    tPcapFile pcap(filename);
+    vector<tPcapRef> records;
+    pcap.scan(records);
+
+    size_t chunks = (records.size() + CHUNK_RECORDS - 1) / CHUNK_RECORDS;
+    vector<vector<tPacket>> parsed(chunks);
+    vector<bool> done(chunks, false);
+    size_t next = 0, saved = 0;
+    exception_ptr failure;
+    bool stop = false;
+    mutex lock;
+    condition_variable cond;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t chunk;
+            {
+                // Parse at most two chunks per thread ahead of the writer
+                unique_lock<mutex> guard(lock);
+                cond.wait(guard, [&]() { return stop || next >= chunks || next < saved + 2*threads; });
+                if (stop || next >= chunks) return;
+                chunk = next++;
+            }
+
+            vector<tPacket> packets;
+            uint64_t damaged = 0;
+            exception_ptr error;
+            try {
+                size_t last = min(records.size(), (chunk+1) * CHUNK_RECORDS);
+                damaged = pcap.parse(records, chunk * CHUNK_RECORDS, last, packets);
+            } catch (...) {
+                error = current_exception();
+            }
+
+            {
+                lock_guard<mutex> guard(lock);
+                parsed[chunk].swap(packets);
+                counters.damaged += damaged;
+                if (error && !failure) failure = error;
+                done[chunk] = true;
+            }
+            cond.notify_all();
+        }
+    };
+
+    // Workers are stopped and joined on any error, then it is rethrown
+    vector<thread> pool;
+    try {
+        for (unsigned t = 0; t < threads; t++) pool.emplace_back(worker);
+
+        for (size_t chunk = 0; chunk < chunks; chunk++) {
+            vector<tPacket> packets;
+            {
+                unique_lock<mutex> guard(lock);
+                cond.wait(guard, [&]() { return (bool) done[chunk]; });
+                if (failure) rethrow_exception(failure);
+                packets.swap(parsed[chunk]);
+                saved = chunk + 1;
+            }
+            cond.notify_all();
+            savePackets(writer, packets, counters);
+        }
+    } catch (...) {
+        {
+            lock_guard<mutex> guard(lock);
+            stop = true;
+        }
+        cond.notify_all();
+        for (thread &t: pool) t.join();
+        throw;
     }
 
-    for (unsigned f = 0; f < args.filecount; f++) {
-        cout << "filename: " << args.filenames[f] << endl;
+    for (thread &t: pool) t.join();
+}
 
-        tPacket pkt;
-        uint64_t pcktsCount = 0;
-        uint64_t bytesCount = 0;
+// Converts a capture file by libpcap, for formats without native support
+template<typename TWriter>
+void convertLibpcap(const char *filename, TWriter &writer, tCounters &counters) {
+#ifndef NOPCAP
+    tPacket pkt;
+    vector<tPacket> packets;
+    tTraceFile tracefile(filename);
+    while (tracefile.nextPacket(pkt)) {
+        packets.push_back(pkt);
+        if (packets.size() < TRACE_BATCH) continue;
+        savePackets(writer, packets, counters);
+        packets.clear();
+    }
+    savePackets(writer, packets, counters);
+    counters.damaged += tracefile.damaged();
+#else
+    (void) filename; (void) writer; (void) counters;
+    throw runtime_error("Unsupported capture file format (compiled without PCAP support)!");
+#endif
+}
 
-        tTraceFile tracefile(args.filenames[f]);
-        tTraceData tracedata(strfrmt("%s%s", args.filenames[f], ".pdat").c_str(), true);
+template<typename TWriter>
+void convertFile(const char *filename, TWriter &writer, unsigned threads, tCounters &counters) {
+    if (tPcapFile::probe(filename)) convertPcap(filename, writer, threads, counters);
+    else convertLibpcap(filename, writer, counters);
+}
 
-        while (tracefile.nextPacket(pkt)) {
-            if (pkt.ipver != 4) continue; // TODO: IPv6 support
+int main(int argc, char *argv[]) try {
 
-            pcktsCount += 1;
-            bytesCount += pkt.length;
+    tArgs args(argc, argv);
+    if (args.help) {
+        args.usage(); return EXIT_SUCCESS;
+    }
 
-            tracedata.savePacket(pkt);
+    // Input files are shared by workers, remaining threads parse chunks
+    unsigned workers = min(args.threads, args.filecount);
+    unsigned threads = args.threads / workers;
+
+    mutex lock;
+    exception_ptr failure;
+    atomic<unsigned> nextfile(0);
+
+    auto worker = [&]() {
+        for (unsigned f; (f = nextfile++) < args.filecount; ) try {
+            tCounters counters;
+            string outname = strfrmt("%s%s", args.filenames[f], ".pdat");
+            if (args.compact) {
+                tTraceCompact tracedata(outname.c_str(), true, args.direct);
+                convertFile(args.filenames[f], tracedata, threads, counters);
+                tracedata.finish();
+            } else {
+                tTraceData tracedata(outname.c_str(), true, false, args.direct);
+                convertFile(args.filenames[f], tracedata, threads, counters);
+                tracedata.finish();
+            }
+
+            lock_guard<mutex> guard(lock);
+            cout << "filename: " << args.filenames[f] << endl;
+            if (counters.damaged > 0) cout << counters.damaged << " packets damaged, skipped." << endl;
+            cout << counters.packets << " packets, " << counters.bytes << " bytes processed." << endl;
+        } catch (...) {
+            lock_guard<mutex> guard(lock);
+            if (!failure) failure = current_exception();
+            nextfile = args.filecount;
         }
+    };
 
-        cout << pcktsCount << " packets, " << bytesCount << " bytes processed." << endl;
-    }
+    vector<thread> pool;
+    for (unsigned w = 0; w < workers; w++) pool.emplace_back(worker);
+    for (thread &t: pool) t.join();
+    if (failure) rethrow_exception(failure);
 
 } catch(exception &e) {
     cerr << __progname << ": " << e.what() << endl;
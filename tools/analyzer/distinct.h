@@ -0,0 +1,204 @@
+#ifndef DISTINCT_H_
+#define DISTINCT_H_
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+
+const unsigned HLL_MIN_PRECISION = 4;
+const unsigned HLL_MAX_PRECISION = 16;
+
+// Exact distinct counter, keys are appended and the vector is sorted and
+// deduplicated whenever it doubles, counters merge by a sorted union
+class tDistinctExact {
+    public:
+        inline void insert(uint64_t key);
+        void merge(tDistinctExact &other);
+        uint64_t count();
+
+    private:
+        vector<uint64_t> _keys;
+        size_t _sorted = 0;
+
+        void _compact();
+};
+
+inline void tDistinctExact::insert(uint64_t key) {
+    _keys.push_back(key);
+    if (_keys.size() >= 2 * _sorted + 16) _compact();
+}
+
+void tDistinctExact::_compact() {
+    if (_sorted == _keys.size()) return;
+    sort(_keys.begin(), _keys.end());
+    _keys.erase(unique(_keys.begin(), _keys.end()), _keys.end());
+    _sorted = _keys.size();
+}
+
+void tDistinctExact::merge(tDistinctExact &other) {
+    _compact();
+    other._compact();
+    if (other._keys.empty()) return;
+    if (_keys.empty()) {
+        _keys = other._keys;
+        _sorted = _keys.size();
+        return;
+    }
+
+    vector<uint64_t> keys;
+    keys.reserve(_keys.size() + other._keys.size());
+    set_union(_keys.begin(), _keys.end(), other._keys.begin(), other._keys.end(), back_inserter(keys));
+    _keys.swap(keys);
+    _sorted = _keys.size();
+}
+
+uint64_t tDistinctExact::count() {
+    _compact();
+    return _keys.size();
+}
+
+// HyperLogLog sketch of 2^precision registers, kept as a sparse list of
+// (index, rank) pairs until that would outgrow the dense registers; sketches
+// of the same precision merge by the register maximum
+class tHyperLogLog {
+    public:
+        tHyperLogLog(unsigned precision = 12);
+        inline void insert(uint64_t key);
+        void merge(const tHyperLogLog &other);
+        uint64_t estimate();
+        unsigned precision() const { return _precision; }
+
+    private:
+        unsigned _precision;
+        vector<uint32_t> _sparse; // Index << 8 | rank
+        size_t _sorted = 0;
+        vector<uint8_t> _dense;
+
+        void _compact();
+        void _densify();
+};
+
+tHyperLogLog::tHyperLogLog(unsigned precision) {
+    _precision = min(max(precision, HLL_MIN_PRECISION), HLL_MAX_PRECISION);
+}
+
+// Index by the top bits of a 64-bit mix of the key, rank by the leading
+// zeros of the rest
+inline void tHyperLogLog::insert(uint64_t key) {
+    uint64_t hash = key + 0x9E3779B97F4A7C15UL;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9UL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBUL;
+    hash ^= hash >> 31;
+
+    uint32_t index = hash >> (64 - _precision);
+    uint8_t rank = __builtin_clzl((hash << _precision) | (1UL << (_precision - 1))) + 1;
+    if (!_dense.empty()) {
+        _dense[index] = max(_dense[index], rank);
+        return;
+    }
+    _sparse.push_back(index << 8 | rank);
+    if (_sparse.size() >= 2 * _sorted + 16) _compact();
+}
+
+// Sorts the sparse list and keeps the highest rank of every index
+void tHyperLogLog::_compact() {
+    if (_sorted == _sparse.size()) return;
+    sort(_sparse.begin(), _sparse.end());
+    size_t used = 0;
+    for (size_t pos = 0; pos < _sparse.size(); pos++) {
+        if (used > 0 && (_sparse[used-1] >> 8) == (_sparse[pos] >> 8)) _sparse[used-1] = _sparse[pos];
+        else _sparse[used++] = _sparse[pos];
+    }
+    _sparse.resize(used);
+    _sorted = used;
+    if (_sparse.size() * sizeof(uint32_t) > (1UL << _precision)) _densify();
+}
+
+void tHyperLogLog::_densify() {
+    _dense.assign(1UL << _precision, 0);
+    for (uint32_t pair: _sparse) _dense[pair >> 8] = max<uint8_t>(_dense[pair >> 8], pair & 0xFF);
+    vector<uint32_t>().swap(_sparse);
+    _sorted = 0;
+}
+
+void tHyperLogLog::merge(const tHyperLogLog &other) {
+    if (!other._dense.empty()) {
+        if (_dense.empty()) _densify();
+        for (size_t idx = 0; idx < _dense.size(); idx++) _dense[idx] = max(_dense[idx], other._dense[idx]);
+    } else if (!_dense.empty()) {
+        for (uint32_t pair: other._sparse) _dense[pair >> 8] = max<uint8_t>(_dense[pair >> 8], pair & 0xFF);
+    } else {
+        _sparse.insert(_sparse.end(), other._sparse.begin(), other._sparse.end());
+        _compact();
+    }
+}
+
+// Raw estimate with linear counting for the small range
+uint64_t tHyperLogLog::estimate() {
+    double registers = 1UL << _precision;
+    double alpha = (_precision == 4) ? 0.673 : (_precision == 5) ? 0.697 : (_precision == 6) ? 0.709 : 0.7213 / (1 + 1.079 / registers);
+    double sum = 0, zeros = 0;
+    if (_dense.empty()) _compact(); // May densify the list
+    if (_dense.empty()) {
+        for (uint32_t pair: _sparse) sum += ldexp(1.0, -(int) (pair & 0xFF));
+        zeros = registers - _sparse.size();
+        sum += zeros;
+    } else {
+        for (uint8_t rank: _dense) {
+            sum += ldexp(1.0, -(int) rank);
+            zeros += (rank == 0);
+        }
+    }
+
+    double estimate = alpha * registers * registers / sum;
+    if (estimate <= 2.5 * registers && zeros > 0) estimate = registers * log(registers / zeros);
+    return llround(estimate);
+}
+
+// Distinct counter of either mode, the precision of the first insertion
+// selects a sketch or exact counting (zero); merges take the mode of the
+// other counter when this one is still empty
+class tDistinct {
+    public:
+        inline void insert(uint64_t key, unsigned precision);
+        void merge(tDistinct &other);
+        uint64_t count();
+
+    private:
+        unsigned _precision = 0;
+        bool _used = false;
+        tDistinctExact _exact;
+        tHyperLogLog _sketch;
+};
+
+inline void tDistinct::insert(uint64_t key, unsigned precision) {
+    if (!_used) {
+        _used = true;
+        _precision = precision;
+        if (precision > 0) _sketch = tHyperLogLog(precision);
+    }
+    if (_precision > 0) _sketch.insert(key);
+    else _exact.insert(key);
+}
+
+void tDistinct::merge(tDistinct &other) {
+    if (!other._used) return;
+    if (!_used) {
+        _used = true;
+        _precision = other._precision;
+        if (_precision > 0) _sketch = tHyperLogLog(_precision);
+    }
+    if (_precision > 0) _sketch.merge(other._sketch);
+    else _exact.merge(other._exact);
+}
+
+uint64_t tDistinct::count() {
+    if (!_used) return 0;
+    return (_precision > 0) ? _sketch.estimate() : _exact.count();
+}
+
+#endif
@@ -5,7 +5,7 @@
 #include <iostream>
 #include <stdexcept>
 
-#include "trace.h"
+#include "trace-open.h"
 
 using namespace std;
 
@@ -20,23 +20,35 @@ struct tArgs {
     uint64_t time = 0;
     bool help = false;
     bool csv = false;
+    bool compact = false;
+    bool direct = false;
+    bool index = false;
 };
 
 inline void tArgs::usage() {
-    cout << "Usage: " << __progname << " [-h] INFILE OUTFILE ..." << endl;
+    cout << "Usage: " << __progname << " [-hczxd] [-o OFFSET] [-t TIME] INFILE OUTFILE ..." << endl;
     cout << "  -h         Show this help message." << endl;
     cout << "  -c         Output in CSV." << endl;
+    cout << "  -z         Output in compressed columnar PDAT v2 format." << endl;
+    cout << "  -d         Write output with direct I/O, bypassing the page cache." << endl;
+    cout << "  -x         Only build the time index of INFILE (PDAT v1)." << endl;
     cout << "  -o OFFSET  Time offset to shift beginning of the interval (in us)." << endl;
     cout << "  -t TIME    Time interval to extract (in us)." << endl;
 }
 
 tArgs::tArgs(int argc, char * const argv[]) {
 
-    for (int opt = 0; (opt = getopt(argc, argv, ":hco:t:")) != -1; ) switch(opt) {
+    for (int opt = 0; (opt = getopt(argc, argv, ":hczxdo:t:")) != -1; ) switch(opt) {
         case 'h':
             help = true; return;
         case 'c':
             csv = true; break;
+        case 'z':
+            compact = true; break;
+        case 'x':
+            index = true; break;
+        case 'd':
+            direct = true; break;
         case 'o':
             offset = strtoul(optarg, nullptr, 10); break;
         case 't':
@@ -58,21 +70,40 @@ int main(int argc, char *argv[]) try {
 
     cout << "filename: " << args.filenames[0] << endl;
 
-    tPacket pkt;
+    // Build the sidecar time index
+    if (args.index) {
+        tBatch batch;
+        tTraceIndex index;
+        uint64_t counter = 0;
+        tTraceMmap tracefile(args.filenames[0]);
+        while (tracefile.nextBatch(batch)) for (const tPacket &pkt: batch) {
+            index.add(counter++, pkt.timestamp);
+        }
+        if (!index.save(string(args.filenames[0]) + INDEX_SUFFIX, counter * sizeof(tPacket)))
+            throw runtime_error("Writing index failed!");
+        cout << index.entries.size() << " index entries, " << counter << " packets indexed." << endl;
+        return EXIT_SUCCESS;
+    }
+
     uint64_t pcktsCount = 0;
     uint64_t bytesCount = 0;
     uint64_t tbegin = 0;
     uint64_t tend = ~0UL;
 
-    tTraceData tracefile(args.filenames[0]);
-    tTraceData tracedata(args.filenames[1], true, args.csv);
+    tBatch batch;
+    unique_ptr<tTrace> tracefile(openTrace(args.filenames[0]));
+    unique_ptr<tTraceData> tracedata(args.compact ? nullptr : new tTraceData(args.filenames[1], true, args.csv, args.direct));
+    unique_ptr<tTraceCompact> tracecompact(args.compact ? new tTraceCompact(args.filenames[1], true, args.direct) : nullptr);
 
-    while (tracefile.nextPacket(pkt)) {
+    while (tracefile->nextBatch(batch)) for (const tPacket &pkt: batch) {
 
         // Set time offset for the beginning of the time interval
         if (tbegin == 0) {
             tbegin = pkt.timestamp + args.offset;
             if (args.time != 0) tend = tbegin + args.time;
+
+            // Jump straight to the interval if the trace is indexed
+            if (tracefile->seek(tbegin, tend)) break;
         }
 
         // TODO: IPv6 support
@@ -84,8 +115,11 @@ int main(int argc, char *argv[]) try {
         pcktsCount += 1;
         bytesCount += pkt.length;
 
-        tracedata.savePacket(pkt);
+        if (args.compact) tracecompact->savePacket(pkt);
+        else tracedata->savePacket(pkt);
     }
+    if (args.compact) tracecompact->finish();
+    else tracedata->finish();
 
     cout << pcktsCount << " packets, " << bytesCount << " bytes processed." << endl;
 
@@ -0,0 +1,107 @@
+#ifndef FLOW_FILTER_H_
+#define FLOW_FILTER_H_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "model.h"
+
+using namespace std;
+
+const size_t FLOW_FILTER_SIZE = 1024;
+const size_t FLOW_FILTER_LIMIT = 1UL << 20;
+const unsigned FLOW_FILTER_PROBES = 16;
+
+// Set of (prefix, destination) pairs seen in a window with a flag for each
+// child of the prefix. Entries tagged by an older epoch are free, so the
+// window is cleared by advancing the epoch. The table grows at half load up
+// to its limit of slots; once there, a new pair not placed within a few
+// probes overwrites its home slot and the filter becomes approximate until
+// the next clear.
+class tFlowFilter {
+    public:
+        tFlowFilter(size_t limit = FLOW_FILTER_LIMIT);
+        inline uint8_t &flags(const tPrefix &pref, const tPrefix &dst);
+        void clear() { _epoch++; _count = 0; _approximate = false; }
+        bool approximate() const { return _approximate; }
+
+    private:
+        struct tSlot {
+            unsigned src = 0;
+            unsigned dst = 0;
+            uint32_t epoch = 0;
+            uint8_t srclen = 0;
+            uint8_t dstlen = 0;
+            uint8_t flags = 0;
+        };
+
+        vector<tSlot> _slots;
+        size_t _limit;
+        size_t _mask;
+        unsigned _shift;
+        size_t _count = 0;
+        uint32_t _epoch = 1;
+        bool _approximate = false;
+
+        inline size_t _home(unsigned src, unsigned srclen, unsigned dst) const;
+        void _grow();
+};
+
+tFlowFilter::tFlowFilter(size_t limit) {
+    _limit = 2;
+    while (_limit < limit) _limit <<= 1;
+    _slots.resize(min(FLOW_FILTER_SIZE, _limit));
+    _mask = _slots.size() - 1;
+    _shift = 64 - __builtin_ctzl(_slots.size());
+}
+
+inline size_t tFlowFilter::_home(unsigned src, unsigned srclen, unsigned dst) const {
+    uint64_t key = ((uint64_t) src << 32 | dst) ^ ((uint64_t) srclen << 26);
+    return (key * 0x9E3779B97F4A7C15UL) >> _shift;
+}
+
+// Flags of the pair, cleared ones if the pair is new in the window
+inline uint8_t &tFlowFilter::flags(const tPrefix &pref, const tPrefix &dst) {
+    if ((_count + 1) * 2 > _slots.size() && _slots.size() < _limit) _grow();
+
+    size_t home = _home(pref.prefix, pref.length, dst.prefix);
+    size_t idx = home;
+    for (unsigned probes = 1; ; probes++, idx = (idx + 1) & _mask) {
+        tSlot &slot = _slots[idx];
+        if (slot.epoch != _epoch) {
+            _count++; break;
+        }
+        if (slot.src == pref.prefix && slot.dst == dst.prefix && slot.srclen == pref.length && slot.dstlen == dst.length)
+            return slot.flags;
+        if (probes >= FLOW_FILTER_PROBES && _slots.size() >= _limit) {
+            idx = home; _approximate = true; break;
+        }
+    }
+
+    tSlot &slot = _slots[idx];
+    slot.src = pref.prefix;
+    slot.dst = dst.prefix;
+    slot.srclen = pref.length;
+    slot.dstlen = dst.length;
+    slot.epoch = _epoch;
+    slot.flags = 0;
+    return slot.flags;
+}
+
+// Doubles the table, only entries of the current epoch are moved
+void tFlowFilter::_grow() {
+    vector<tSlot> slots(_slots.size() * 2);
+    slots.swap(_slots);
+    _mask = _slots.size() - 1;
+    _shift--;
+
+    for (tSlot &slot: slots) {
+        if (slot.epoch != _epoch) continue;
+        size_t idx = _home(slot.src, slot.srclen, slot.dst);
+        while (_slots[idx].epoch == _epoch) idx = (idx + 1) & _mask;
+        _slots[idx] = slot;
+    }
+}
+
+#endif
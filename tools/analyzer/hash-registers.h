@@ -0,0 +1,419 @@
+#ifndef HASH_REGISTERS_H_
+#define HASH_REGISTERS_H_
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "model.h"
+
+using namespace std;
+
+struct tNodeHash {
+    tPrefix prefix;
+    bool valid = false;
+    uint64_t timestamp = 0;
+    uint64_t childvals[2] = {0, 0};
+    uint64_t summaryval = 0;
+
+    tNodeHash() = default;
+    tNodeHash(tPrefix pref): prefix(pref), valid(true) {}
+};
+
+// Prefixes and slots of a packet by prefix length, with bit masks of the
+// last prefix bits of the packet and of the nodes, and of valid nodes
+struct tHashLevels {
+    unsigned prefix[32+1];
+    uint64_t slot[32+1];
+    uint64_t lastbits;
+    uint64_t nodebits;
+    uint64_t valid;
+};
+
+// Nodes of all levels in a single array, a slot is the level base plus the
+// index in the level; a node is invalidated by a zero timestamp
+class tHashNodes {
+    public:
+        void init(const vector<uint64_t> &sizes, unsigned firstlen);
+        inline uint64_t base(unsigned len) const { return _bases[len]; }
+        inline void masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation);
+        inline bool match(uint64_t slot, const tPrefix &pref) const { return _nodes[slot].prefix == pref; }
+        inline uint64_t timestamp(uint64_t slot) const { return _nodes[slot].timestamp; }
+        inline uint64_t childval(uint64_t slot, bool child) const { return _nodes[slot].childvals[child]; }
+        inline uint64_t summaryval(uint64_t slot) const { return _nodes[slot].summaryval; }
+        inline void reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval);
+        inline void set(uint64_t slot, bool child, uint64_t cval, uint64_t sval);
+        inline void add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc);
+        inline void invalidate(uint64_t slot) { _nodes[slot].timestamp = 0; _nodes[slot].valid = false; }
+        size_t bytes() const { return _nodes.size() * sizeof(tNodeHash); }
+
+    private:
+        vector<tNodeHash> _nodes;
+        uint64_t _bases[32+1] = {};
+};
+
+// Compact registers of all levels in a single arena like HHH_REGSIZE of
+// hhh.p4, stored as structure of arrays: a 64-bit tag of a 48-bit timestamp
+// relative to the first packet above a 16-bit prefix fingerprint, whose
+// lowest bit is the last prefix bit, and 32-bit saturating counters. Nodes
+// are matched by fingerprints, a zero timestamp is an invalid node.
+class tHashRegisters {
+    public:
+        void init(const vector<uint64_t> &sizes, unsigned firstlen);
+        inline uint64_t base(unsigned len) const { return _bases[len]; }
+        inline void masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation);
+        inline bool match(uint64_t slot, const tPrefix &pref) const { return (uint16_t) _tags[slot] == _fingerprint(pref); }
+        inline uint64_t timestamp(uint64_t slot) const;
+        inline uint64_t childval(uint64_t slot, bool child) const { return _childvals[child][slot]; }
+        inline uint64_t summaryval(uint64_t slot) const { return _summaryvals[slot]; }
+        inline void reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval);
+        inline void set(uint64_t slot, bool child, uint64_t cval, uint64_t sval);
+        inline void add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc);
+        inline void invalidate(uint64_t slot) { _tags[slot] &= 0xFFFF; }
+        size_t bytes() const { return _tags.size() * (sizeof(uint64_t) + 3 * sizeof(uint32_t)); }
+
+    private:
+        static const uint64_t TIME_MASK = (1UL << 48) - 1;
+
+        vector<uint64_t> _tags;
+        vector<uint32_t> _childvals[2];
+        vector<uint32_t> _summaryvals;
+        uint64_t _bases[32+1] = {};
+        uint64_t _start = 0;
+        bool _started = false;
+
+        static inline uint16_t _fingerprint(const tPrefix &pref);
+        static inline uint32_t _saturate(uint64_t value) { return min<uint64_t>(value, UINT32_MAX); }
+};
+
+const unsigned BUCKET_WAYS = 8;
+
+// Set-associative buckets of registers, a slot of a level selects a bucket
+// of eight ways and the prefix takes the way of its fingerprint. A bucket
+// holds the 16-bit fingerprints and 48-bit timestamps of its ways in one
+// cache line, fingerprints are compared by SSE2; counters are 32-bit and
+// saturating in separate arrays like tHashRegisters. A missing prefix
+// takes a free way, one timed out by inactivity, or else the way of the
+// lowest value and the oldest timestamp.
+class tHashBuckets {
+    public:
+        void init(const vector<uint64_t> &sizes, unsigned firstlen, uint64_t itimeout);
+        inline uint64_t base(unsigned len) const { return _bases[len]; }
+        inline void masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation);
+        inline bool match(uint64_t slot, const tPrefix &pref) const { return _bucket(slot).fps[slot % BUCKET_WAYS] == _fingerprint(pref); }
+        inline uint64_t timestamp(uint64_t slot) const;
+        inline uint64_t childval(uint64_t slot, bool child) const { return _childvals[child][slot]; }
+        inline uint64_t summaryval(uint64_t slot) const { return _summaryvals[slot]; }
+        inline void reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval);
+        inline void set(uint64_t slot, bool child, uint64_t cval, uint64_t sval);
+        inline void add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc);
+        inline void invalidate(uint64_t slot);
+        size_t bytes() const { return _count * (sizeof(tBucket) + BUCKET_WAYS * 3 * sizeof(uint32_t)); }
+        uint64_t evictions() const { return _evictions; }
+
+    private:
+        struct tBucket {
+            uint16_t fps[BUCKET_WAYS];
+            uint32_t timelo[BUCKET_WAYS];
+            uint16_t timehi[BUCKET_WAYS];
+        };
+
+        struct tFree {
+            void operator()(tBucket *ptr) const { free(ptr); }
+        };
+
+        static const uint64_t TIME_MASK = (1UL << 48) - 1;
+
+        unique_ptr<tBucket[],tFree> _buckets;
+        size_t _count = 0;
+        vector<uint32_t> _childvals[2];
+        vector<uint32_t> _summaryvals;
+        uint64_t _bases[32+1] = {};
+        uint64_t _itimeout = 0;
+        uint64_t _start = 0;
+        bool _started = false;
+        uint64_t _evictions = 0;
+
+        inline tBucket &_bucket(uint64_t slot) const { return _buckets[slot / BUCKET_WAYS]; }
+        static inline uint64_t _time(const tBucket &bucket, unsigned way) { return (uint64_t) bucket.timehi[way] << 32 | bucket.timelo[way]; }
+        static inline uint16_t _fingerprint(const tPrefix &pref);
+        static inline uint32_t _saturate(uint64_t value) { return min<uint64_t>(value, UINT32_MAX); }
+};
+
+void tHashNodes::init(const vector<uint64_t> &sizes, unsigned firstlen) {
+    uint64_t slots = 0;
+    for (unsigned len = firstlen; len < firstlen + sizes.size(); len++) {
+        _bases[len] = slots;
+        slots += sizes[len-firstlen];
+    }
+    _nodes.assign(slots, tNodeHash());
+}
+
+inline void tHashNodes::masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation) {
+    const tNodeHash *nodes[32+1];
+    lv.nodebits = 0;
+    lv.valid = 0;
+
+    // Last bit of the node prefix, as tPrefix::operator[]
+    for (unsigned len = firstlen; len <= lastlen; len++) {
+        nodes[len] = &_nodes[lv.slot[len]];
+        const tPrefix &nodepref = nodes[len]->prefix;
+        if (len > 0 && nodepref.length >= len && ((nodepref.prefix >> (32-len)) & 1)) lv.nodebits |= 1UL << len;
+    }
+
+    unsigned len = firstlen;
+#ifdef __AVX2__
+    // Gather flags or timestamps of four levels at once
+    const __m256i sign = _mm256_set1_epi64x(1UL << 63);
+    const __m256i current = _mm256_xor_si256(_mm256_set1_epi64x(now), sign);
+    const __m256i timeout = _mm256_set1_epi64x(itimeout);
+    const __m256i flag = _mm256_set1_epi64x(0xFF);
+    const __m256i offset = _mm256_set1_epi64x(newinvalidation ? offsetof(tNodeHash, valid) : offsetof(tNodeHash, timestamp));
+    for (; len + 4 <= lastlen + 1; len += 4) {
+        __m256i addrs = _mm256_add_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(nodes + len)), offset);
+        __m256i values = _mm256_i64gather_epi64(nullptr, addrs, 1);
+        __m256i valid;
+        if (newinvalidation) {
+            valid = _mm256_cmpeq_epi64(_mm256_and_si256(values, flag), _mm256_setzero_si256());
+            valid = _mm256_xor_si256(valid, _mm256_set1_epi64x(-1));
+        } else {
+            valid = _mm256_cmpgt_epi64(_mm256_xor_si256(_mm256_add_epi64(values, timeout), sign), current);
+        }
+        lv.valid |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(valid)) << len;
+    }
+#endif
+    for (; len <= lastlen; len++) {
+        const tNodeHash &node = *nodes[len];
+        if ((newinvalidation && node.valid) || (!newinvalidation && node.timestamp + itimeout > now))
+            lv.valid |= 1UL << len;
+    }
+}
+
+inline void tHashNodes::reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval) {
+    tNodeHash &node = _nodes[slot] = tNodeHash(pref);
+    node.childvals[child] = cval;
+    node.summaryval = sval;
+    node.timestamp = timestamp;
+}
+
+inline void tHashNodes::set(uint64_t slot, bool child, uint64_t cval, uint64_t sval) {
+    _nodes[slot].childvals[child] = cval;
+    _nodes[slot].summaryval = sval;
+}
+
+inline void tHashNodes::add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc) {
+    _nodes[slot].childvals[child] += cinc;
+    _nodes[slot].summaryval += sinc;
+}
+
+void tHashRegisters::init(const vector<uint64_t> &sizes, unsigned firstlen) {
+    uint64_t slots = 0;
+    for (unsigned len = firstlen; len < firstlen + sizes.size(); len++) {
+        _bases[len] = slots;
+        slots += sizes[len-firstlen];
+    }
+    _tags.assign(slots, 0);
+    _childvals[0].assign(slots, 0);
+    _childvals[1].assign(slots, 0);
+    _summaryvals.assign(slots, 0);
+    _started = false;
+}
+
+// Fibonacci hashing of the length and the prefix, the last prefix bit kept
+inline uint16_t tHashRegisters::_fingerprint(const tPrefix &pref) {
+    if (pref.length == 0) return 0;
+    uint64_t key = ((uint64_t) pref.length << 32) | pref.prefix;
+    uint16_t hash = (key * 0x9E3779B97F4A7C15UL) >> 48;
+    return (hash & ~1U) | ((pref.prefix >> (32-pref.length)) & 1);
+}
+
+// Absolute time of the node, zero if invalid
+inline uint64_t tHashRegisters::timestamp(uint64_t slot) const {
+    uint64_t time = _tags[slot] >> 16;
+    return (time == 0) ? 0 : time - 1 + _start;
+}
+
+inline void tHashRegisters::masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation) {
+    lv.nodebits = 0;
+    lv.valid = 0;
+
+    unsigned len = firstlen;
+#ifdef __AVX2__
+    // Gather tags of four levels at once, the last prefix bit is moved to
+    // the sign bit
+    const __m256i sign = _mm256_set1_epi64x(1UL << 63);
+    const __m256i current = _mm256_xor_si256(_mm256_set1_epi64x(now), sign);
+    const __m256i shift = _mm256_set1_epi64x(_start - 1 + itimeout);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; len + 4 <= lastlen + 1; len += 4) {
+        __m256i slots = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lv.slot + len));
+        __m256i tags = _mm256_i64gather_epi64(reinterpret_cast<const long long *>(_tags.data()), slots, 8);
+        __m256i times = _mm256_srli_epi64(tags, 16);
+        __m256i valid = _mm256_xor_si256(_mm256_cmpeq_epi64(times, zero), _mm256_set1_epi64x(-1));
+        if (!newinvalidation)
+            valid = _mm256_and_si256(valid, _mm256_cmpgt_epi64(_mm256_xor_si256(_mm256_add_epi64(times, shift), sign), current));
+        lv.valid |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(valid)) << len;
+        lv.nodebits |= (uint64_t) _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(tags, 63))) << len;
+    }
+#endif
+    for (; len <= lastlen; len++) {
+        uint64_t tag = _tags[lv.slot[len]];
+        uint64_t time = tag >> 16;
+        if (time != 0 && (newinvalidation || time - 1 + _start + itimeout > now))
+            lv.valid |= 1UL << len;
+        if (tag & 1) lv.nodebits |= 1UL << len;
+    }
+}
+
+// Times are kept relative to the first packet, half of the 48-bit range
+// is left before it for traces read out of order
+inline void tHashRegisters::reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval) {
+    if (!_started) {
+        _start = timestamp - (1UL << 47);
+        _started = true;
+    }
+    _tags[slot] = (((timestamp - _start + 1) & TIME_MASK) << 16) | _fingerprint(pref);
+    _childvals[child][slot] = _saturate(cval);
+    _childvals[!child][slot] = 0;
+    _summaryvals[slot] = _saturate(sval);
+}
+
+inline void tHashRegisters::set(uint64_t slot, bool child, uint64_t cval, uint64_t sval) {
+    _childvals[child][slot] = _saturate(cval);
+    _summaryvals[slot] = _saturate(sval);
+}
+
+inline void tHashRegisters::add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc) {
+    _childvals[child][slot] = _saturate(_childvals[child][slot] + cinc);
+    _summaryvals[slot] = _saturate(_summaryvals[slot] + sinc);
+}
+
+// Levels are rounded up to whole buckets
+void tHashBuckets::init(const vector<uint64_t> &sizes, unsigned firstlen, uint64_t itimeout) {
+    uint64_t slots = 0;
+    for (unsigned len = firstlen; len < firstlen + sizes.size(); len++) {
+        _bases[len] = slots;
+        slots += (sizes[len-firstlen] + BUCKET_WAYS - 1) / BUCKET_WAYS * BUCKET_WAYS;
+    }
+
+    _count = slots / BUCKET_WAYS;
+    void *ptr;
+    if (posix_memalign(&ptr, sizeof(tBucket), _count * sizeof(tBucket)) != 0) throw bad_alloc();
+    _buckets.reset(static_cast<tBucket *>(ptr));
+    memset(_buckets.get(), 0, _count * sizeof(tBucket));
+
+    _childvals[0].assign(slots, 0);
+    _childvals[1].assign(slots, 0);
+    _summaryvals.assign(slots, 0);
+    _itimeout = itimeout;
+    _started = false;
+}
+
+inline uint16_t tHashBuckets::_fingerprint(const tPrefix &pref) {
+    uint64_t key = ((uint64_t) pref.length << 32) | pref.prefix;
+    return (key * 0x9E3779B97F4A7C15UL) >> 48;
+}
+
+inline uint64_t tHashBuckets::timestamp(uint64_t slot) const {
+    uint64_t time = _time(_bucket(slot), slot % BUCKET_WAYS);
+    return (time == 0) ? 0 : time - 1 + _start;
+}
+
+// Resolves slots of the packet prefixes to their ways, or to the ways they
+// would replace when missing
+inline void tHashBuckets::masks(tHashLevels &lv, unsigned firstlen, unsigned lastlen, uint64_t now, uint64_t itimeout, bool newinvalidation) {
+    lv.nodebits = 0;
+    lv.valid = 0;
+
+    for (unsigned len = firstlen; len <= lastlen; len++) {
+        uint64_t first = lv.slot[len] - lv.slot[len] % BUCKET_WAYS;
+        const tBucket &bucket = _bucket(first);
+        tPrefix pref; pref.prefix = lv.prefix[len]; pref.length = len;
+        uint16_t fp = _fingerprint(pref);
+
+        // Ways of the same fingerprint, byte mask pairs are squeezed to bits
+#ifdef __SSE2__
+        __m128i fps = _mm_load_si128(reinterpret_cast<const __m128i *>(bucket.fps));
+        unsigned ways = _mm_movemask_epi8(_mm_cmpeq_epi16(fps, _mm_set1_epi16(fp))) & 0x5555;
+        ways = (ways | ways >> 1) & 0x3333;
+        ways = (ways | ways >> 2) & 0x0F0F;
+        ways = (ways | ways >> 4) & 0x00FF;
+#else
+        unsigned ways = 0;
+        for (unsigned way = 0; way < BUCKET_WAYS; way++)
+            if (bucket.fps[way] == fp) ways |= 1U << way;
+#endif
+        for (; ways != 0; ways &= ways - 1) {
+            unsigned way = __builtin_ctz(ways);
+            uint64_t time = _time(bucket, way);
+            if (time == 0) continue;
+            lv.slot[len] = first + way;
+            if (newinvalidation || time - 1 + _start + itimeout > now) lv.valid |= 1UL << len;
+            break;
+        }
+        if (ways != 0) continue;
+
+        // Victim way of the missing prefix
+        unsigned victim = 0;
+        for (unsigned way = 0; way < BUCKET_WAYS; way++) {
+            uint64_t time = _time(bucket, way);
+            if (time == 0 || time - 1 + _start + itimeout <= now) {
+                victim = way; break;
+            }
+            uint64_t value = _summaryvals[first + way], best = _summaryvals[first + victim];
+            if (value < best || (value == best && time < _time(bucket, victim))) victim = way;
+        }
+        lv.slot[len] = first + victim;
+    }
+}
+
+inline void tHashBuckets::reset(uint64_t slot, const tPrefix &pref, uint64_t timestamp, bool child, uint64_t cval, uint64_t sval) {
+    if (!_started) {
+        _start = timestamp - (1UL << 47);
+        _started = true;
+    }
+
+    // Replacing a live node of another prefix is an eviction
+    tBucket &bucket = _bucket(slot);
+    unsigned way = slot % BUCKET_WAYS;
+    uint16_t fp = _fingerprint(pref);
+    uint64_t time = _time(bucket, way);
+    if (time != 0 && time - 1 + _start + _itimeout > timestamp && bucket.fps[way] != fp) _evictions++;
+
+    time = (timestamp - _start + 1) & TIME_MASK;
+    bucket.fps[way] = fp;
+    bucket.timelo[way] = time;
+    bucket.timehi[way] = time >> 32;
+    _childvals[child][slot] = _saturate(cval);
+    _childvals[!child][slot] = 0;
+    _summaryvals[slot] = _saturate(sval);
+}
+
+inline void tHashBuckets::invalidate(uint64_t slot) {
+    tBucket &bucket = _bucket(slot);
+    bucket.timelo[slot % BUCKET_WAYS] = 0;
+    bucket.timehi[slot % BUCKET_WAYS] = 0;
+}
+
+inline void tHashBuckets::set(uint64_t slot, bool child, uint64_t cval, uint64_t sval) {
+    _childvals[child][slot] = _saturate(cval);
+    _summaryvals[slot] = _saturate(sval);
+}
+
+inline void tHashBuckets::add(uint64_t slot, bool child, uint64_t cinc, uint64_t sinc) {
+    _childvals[child][slot] = _saturate(_childvals[child][slot] + cinc);
+    _summaryvals[slot] = _saturate(_summaryvals[slot] + sinc);
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef HASH_REPORT_H_
+#define HASH_REPORT_H_
+
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "model.h"
+#include "report.h"
+
+using namespace std;
+
+// Collision report of the hash families over the source addresses of the
+// trace; for every hashed level the distinct prefixes are placed into a
+// table of the level size and compared with a random hash, which fills
+// m(1-(1-1/m)^D) of m slots by D keys
+struct tModelHashReport : public tModel {
+    unsigned firstlen = 16;
+    unsigned lastlen = 32;
+    vector<uint64_t> memsizes; // By length from firstlen
+
+    vector<unsigned> addrs;
+
+    virtual bool processPacket(tPacket &pkt) override {
+        addrs.push_back(pkt.srcPrefix.prefix);
+        return true;
+    }
+
+    virtual void flush() override {
+        sort(addrs.begin(), addrs.end());
+        addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+
+        for (unsigned f = 0; f < HASH_FAMILIES; f++) switch (f) {
+            case HASH_CRC32: family<tHashCrc32>(f); break;
+            case HASH_CRC32C: family<tHashCrc32c>(f); break;
+            case HASH_MULSHIFT: family<tHashMulShift>(f); break;
+            case HASH_TABULATION: family<tHashTabulation>(f); break;
+            default: family<tHashStd>(f); break;
+        }
+        addrs.clear();
+    }
+
+    virtual void clear() override {
+        addrs.clear();
+    }
+
+    template<typename F>
+    void family(unsigned f) {
+        ostream &out = report->text();
+        uint64_t hashes = 0;
+        double seconds = 0;
+
+        vector<unsigned> prefixes;
+        vector<bool> slots;
+        for (unsigned len = firstlen; len <= lastlen; len++) {
+            uint64_t memsize = memsizes[len-firstlen];
+            if (len == 0 || (1UL << len) <= memsize) continue;
+
+            unsigned mask = ~0U << (32-len);
+            prefixes.clear();
+            for (unsigned addr: addrs) {
+                if (prefixes.empty() || prefixes.back() != (addr & mask)) prefixes.push_back(addr & mask);
+            }
+
+            tHashRange range(memsize);
+            slots.assign(memsize, false);
+            uint64_t occupied = 0;
+            auto begin = chrono::steady_clock::now();
+            for (unsigned prefix: prefixes) {
+                uint64_t index = range.index(F::hash(prefix, len), (prefix >> (32-len)) & 1);
+                if (!slots[index]) { slots[index] = true; occupied++; }
+            }
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            hashes += prefixes.size();
+
+            double keys = prefixes.size();
+            double expected = keys - memsize * (1 - pow(1 - 1.0 / memsize, keys));
+            uint64_t collisions = prefixes.size() - occupied;
+            out << "hash-" << tHash::names[f] << ": " << len << ": " << prefixes.size() << " prefixes, ";
+            out << memsize << " slots, " << collisions << " collisions (";
+            out << (keys > 0 ? collisions / keys : 0) << ", expected " << (keys > 0 ? expected / keys : 0) << ")" << endl;
+        }
+
+        out << "hash-" << tHash::names[f] << ": " << (seconds > 0 ? hashes / seconds / 1e6 : 0) << " Mhash/s" << endl;
+    }
+};
+
+#endif
@@ -5,7 +5,7 @@
 #include <iostream>
 #include <stdexcept>
 
-#include "trace.h"
+#include "trace-open.h"
 #include "hashpipe.h"
 
 using namespace std;
@@ -57,7 +57,6 @@ int main(int argc, char *argv[]) try {
     // cout << "offset: " << args.offset << endl;
     // cout << "time: " << args.time << endl;
 
-    tPacket pkt;
     uint64_t pcktsCount = 0;
     uint64_t bytesCount = 0;
     uint64_t tbegin = 0;
@@ -65,13 +64,17 @@ int main(int argc, char *argv[]) try {
 
     tHashPipe hashpipe(args.D, args.S);
 
-    tTraceData tracefile(args.filename);
-    while (tracefile.nextPacket(pkt)) {
+    tBatch batch;
+    unique_ptr<tTrace> tracefile(openTrace(args.filename));
+    while (tracefile->nextBatch(batch)) for (const tPacket &pkt: batch) {
 
         // Set time offset for the beginning of the time interval
         if (tbegin == 0) {
             tbegin = pkt.timestamp + args.offset;
             if (args.time != 0) tend = tbegin + args.time;
+
+            // Jump straight to the interval if the trace is indexed
+            if (tracefile->seek(tbegin, tend)) break;
         }
 
         // TODO: IPv6 support
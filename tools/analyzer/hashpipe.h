@@ -9,7 +9,7 @@ using namespace std;
 
 class tHashPipe {
     public:
-        void processPacket(tPacket &pkt);
+        void processPacket(const tPacket &pkt);
         multimap<unsigned,unsigned> getFlows();
 
         tHashPipe(unsigned D, unsigned S) {
@@ -54,7 +54,7 @@ class tHashPipe {
         3221, 3229, 3251, 3253, 3257, 3259, 3271, 3299, 3301, 3307, 3313, 3319, 3323, 3329, 3331};
 };
 
-void tHashPipe::processPacket(tPacket &pkt) {
+void tHashPipe::processPacket(const tPacket &pkt) {
 
     unsigned keyBeingCarried = pkt.srcPrefix.prefix;
     unsigned valueBeingCarried = 1;
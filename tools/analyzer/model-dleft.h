@@ -0,0 +1,261 @@
+#ifndef MODEL_DLEFT_H_
+#define MODEL_DLEFT_H_
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+#include <byteswap.h>
+
+#include "model.h"
+#include "report.h"
+#include "model-p4.h"
+
+using namespace std;
+
+// Constants of dleft.p4
+const uint64_t DLEFT_EXTENDER = 1UL << 32;
+
+// 66-bit hash entry, [33 bits encoded prefix][1 bit longer exists][32 bits next hop]
+struct tDleftEntry {
+    uint64_t head = 0; // Encoded prefix and longer exists bit
+    uint32_t nexthop = 0;
+
+    inline bool empty() const { return head == 0 && nexthop == 0; }
+    inline bool operator==(const tDleftEntry &entry) const { return head == entry.head && nexthop == entry.nexthop; }
+    inline uint64_t prefix() const { return head >> 1; }
+    inline bool longer() const { return head & 1; }
+};
+
+// Action parameters of lookup_tab entries
+struct tDleftRoute {
+    uint8_t len = 0;
+    bool longer = false;
+    uint32_t nexthop = 0;
+};
+
+// Emulation of the dleft.p4 cache of an LPM table in two register arrays,
+// crc_hash_reg indexed by CRC-32 and rand_hash_reg by identity of the 33-bit
+// encoded prefix, with the pe_tab ternary priority encoder over the stages
+// holding the prefix and the lookup_tab LPM table, both loaded from a
+// runtime CLI file like dleft.config. The program checks the cached entry
+// before pe_tab selects the stage and writes lookup_tab results to the
+// indices of that stage, so the emulator follows the intended flow instead:
+// the entry of the longest cached prefix serves the packet unless longer
+// prefixes exist, otherwise the table result is written to the free CRC or
+// random slot of its length, and a double collision leaves it uncached.
+// EXTENDER is taken as the 33rd bit it is meant to be.
+struct tModelDleft : public tModel {
+    uint32_t tabsize = HHH_TABSIZE;
+
+    vector<tP4Ternary> pe_tab;
+    unordered_map<uint32_t, tDleftRoute> lookup_tab[33]; // By prefix length
+    vector<uint8_t> lookup_lens; // Lengths of lookup_tab from the longest
+
+    // Memory registers
+    vector<tDleftEntry> crc_hash_reg;
+    vector<tDleftEntry> rand_hash_reg;
+
+    // Statistics, hash hits by [crc_read][rand_read][crc_write][rand_write]
+    uint64_t packets = 0;
+    uint64_t queries = 0;
+    uint64_t hashhits[4] = {0, 0, 0, 0};
+    uint64_t served[2] = {0, 0};
+    uint64_t writes[2] = {0, 0};
+    uint64_t cached = 0; // Table results already in a slot, like prefixes with longer ones
+    uint64_t collisions = 0;
+
+    void init(const char *configfile) {
+        load(configfile);
+        stable_sort(pe_tab.begin(), pe_tab.end(), [](const tP4Ternary &a, const tP4Ternary &b) {
+            return a.priority < b.priority;
+        });
+        for (unsigned len = 33; len-- > 0;) {
+            if (!lookup_tab[len].empty()) lookup_lens.push_back(len);
+        }
+
+        uint32_t regsize = tabsize * HHH_TABCOUNT + 1;
+        crc_hash_reg.assign(regsize, tDleftEntry());
+        rand_hash_reg.assign(regsize, tDleftEntry());
+
+        size_t routes = 0;
+        for (unsigned len = 0; len <= 32; len++) routes += lookup_tab[len].size();
+        report->text() << "dleft-registers: " << regsize << ", pe-entries: " << pe_tab.size();
+        report->text() << ", lookup-entries: " << routes << endl;
+    }
+
+    // Reads pe_tab and lookup_tab entries, other commands are ignored
+    void load(const char *filename) {
+        ifstream file(filename);
+        if (!file) throw runtime_error(string("opening dleft config file '") + filename + "' failed");
+
+        string line;
+        while (getline(file, line)) {
+            istringstream in(line);
+            string command, name, action, key, arrow;
+            in >> command >> name >> action >> key >> arrow;
+            name = name.substr(name.rfind('.') + 1);
+            if (command != "table_add") continue;
+
+            if (name == "pe_tab") {
+                unsigned len;
+                tP4Ternary entry;
+                in >> len >> entry.priority;
+                size_t pos = key.find("&&&");
+                if (!in || arrow != "=>" || pos == string::npos || len > 32)
+                    throw runtime_error("invalid dleft config line '" + line + "'");
+                entry.value = stoul(key.substr(0, pos), nullptr, 0);
+                entry.mask = stoul(key.substr(pos + 3), nullptr, 0);
+                entry.params[0] = len;
+                pe_tab.push_back(entry);
+            } else if (name == "lookup_tab") {
+                unsigned a, b, c, d, len, curlen, longer;
+                string nexthop;
+                tDleftRoute route;
+                in >> curlen >> longer >> nexthop;
+                if (!in || arrow != "=>" || curlen > 32 ||
+                    sscanf(key.c_str(), "%u.%u.%u.%u/%u", &a, &b, &c, &d, &len) != 5 || len > 32)
+                    throw runtime_error("invalid dleft config line '" + line + "'");
+                route.len = curlen;
+                route.longer = longer & 1;
+                route.nexthop = stoul(nexthop, nullptr, 0);
+                lookup_tab[len][prefix((a << 24) | (b << 16) | (c << 8) | d, len)] = route;
+            }
+        }
+    }
+
+    // Prefix of the address with host bits cleared
+    static inline uint32_t prefix(uint32_t addr, uint8_t len) {
+        return (len == 0) ? 0 : addr & (~0U << (32 - len));
+    }
+
+    // CRC-32 of the 33-bit key as the five bytes hashed by bmv2
+    static inline uint32_t crc33(uint64_t key) {
+        uint32_t crc = (~0U >> 8) ^ tHash::crc32lookup[0][(~0U ^ (key >> 32)) & 0xFF];
+        crc ^= __bswap_32(key);
+        crc = tHash::crc32lookup[3][crc & 0xFF] ^ tHash::crc32lookup[2][(crc >> 8) & 0xFF]
+            ^ tHash::crc32lookup[1][(crc >> 16) & 0xFF] ^ tHash::crc32lookup[0][crc >> 24];
+        return ~crc;
+    }
+
+    // lookup_tab, lpm_table_match(0, 0, 0) by default
+    inline tDleftRoute lookup(uint32_t addr) {
+        for (uint8_t len: lookup_lens) {
+            auto it = lookup_tab[len].find(prefix(addr, len));
+            if (it != lookup_tab[len].end()) return it->second;
+        }
+        return tDleftRoute();
+    }
+
+    // parse_hash_val, true when the entry serves the packet
+    inline bool parse(const tDleftEntry &entry, uint64_t cur_prefix) const {
+        return !entry.empty() && entry.prefix() == cur_prefix && !entry.longer();
+    }
+
+    virtual bool processPacket(tPacket &pkt) override {
+        uint64_t ext = DLEFT_EXTENDER | pkt.srcPrefix.prefix;
+        packets++;
+
+        // hash_compute and hash_lookup: indices of all stages and the vector
+        // of stages with a matching prefix in either register
+        uint32_t crc_idx[HHH_TABCOUNT+1], rand_idx[HHH_TABCOUNT+1];
+        uint32_t vector = 0;
+        crc_idx[0] = rand_idx[0] = tabsize * HHH_TABCOUNT;
+        for (unsigned len = 1; len <= HHH_TABCOUNT; len++) {
+            uint64_t key = ext >> (32 - len);
+            crc_idx[len] = (len - 1) * tabsize + crc33(key) % tabsize;
+            rand_idx[len] = (len - 1) * tabsize + key % tabsize;
+            if ((uint32_t) crc_hash_reg[crc_idx[len]].prefix() == (uint32_t) key ||
+                (uint32_t) rand_hash_reg[rand_idx[len]].prefix() == (uint32_t) key)
+                vector |= 0x80000000U >> (len - 1);
+        }
+
+        // pe_tab, found_hash_lpm(0) by default
+        uint8_t cur_len = 0;
+        for (const tP4Ternary &entry: pe_tab) {
+            if ((vector & entry.mask) != (entry.value & entry.mask)) continue;
+            cur_len = entry.params[0];
+            break;
+        }
+        uint64_t cur_prefix = ext >> (32 - cur_len);
+
+        // Cached entries of the stage
+        const tDleftEntry &crc_entry = crc_hash_reg[crc_idx[cur_len]];
+        if (!crc_entry.empty()) hashhits[3]++;
+        if (parse(crc_entry, cur_prefix)) {
+            served[0]++;
+            return true;
+        }
+        const tDleftEntry &rand_entry = rand_hash_reg[rand_idx[cur_len]];
+        if (!rand_entry.empty()) hashhits[2]++;
+        if (parse(rand_entry, cur_prefix)) {
+            served[1]++;
+            return true;
+        }
+
+        // lookup_tab and the write into the stage of the matched length
+        queries++;
+        tDleftRoute route = lookup(pkt.srcPrefix.prefix);
+        cur_len = min<uint8_t>(route.len, HHH_TABCOUNT);
+        tDleftEntry entry;
+        entry.head = (ext >> (32 - cur_len)) << 1 | route.longer;
+        entry.nexthop = route.nexthop;
+
+        tDleftEntry &crc_slot = crc_hash_reg[crc_idx[cur_len]];
+        if (crc_slot.empty()) {
+            crc_slot = entry;
+            writes[0]++;
+            return true;
+        }
+        hashhits[1]++;
+        tDleftEntry &rand_slot = rand_hash_reg[rand_idx[cur_len]];
+        if (rand_slot.empty()) {
+            rand_slot = entry;
+            writes[1]++;
+            return true;
+        }
+        hashhits[0]++;
+        if (crc_slot == entry || rand_slot == entry) cached++;
+        else collisions++;
+        return true;
+    }
+
+    virtual void clear() override {
+    }
+
+    virtual void flush() override {
+        ostream &out = report->text();
+        out << "dleft: " << packets << " packets, " << served[0] + served[1] << " served (crc " << served[0];
+        out << ", rand " << served[1] << "), " << queries << " table queries" << endl;
+        out << "dleft-hits: crc read " << hashhits[3] << ", rand read " << hashhits[2];
+        out << ", crc write " << hashhits[1] << ", rand write " << hashhits[0] << endl;
+        out << "dleft-writes: crc " << writes[0] << ", rand " << writes[1] << ", " << cached << " cached, ";
+        out << collisions << " double collisions (" << (queries > 0 ? (double) collisions / queries : 0) << ")" << endl;
+
+        // Occupancy of the stages, the last slot holds the default route
+        uint64_t total[2] = {0, 0};
+        for (unsigned len = 0; len <= HHH_TABCOUNT; len++) {
+            uint32_t base = (len == 0) ? tabsize * HHH_TABCOUNT : (len - 1) * tabsize;
+            uint32_t slots = (len == 0) ? 1 : tabsize;
+            uint64_t used[2] = {0, 0};
+            for (uint32_t idx = base; idx < base + slots; idx++) {
+                used[0] += !crc_hash_reg[idx].empty();
+                used[1] += !rand_hash_reg[idx].empty();
+            }
+            total[0] += used[0];
+            total[1] += used[1];
+            if (used[0] == 0 && used[1] == 0) continue;
+            out << "dleft: " << len << ": crc " << used[0] << ", rand " << used[1] << " of " << slots << " slots" << endl;
+        }
+        double regsize = crc_hash_reg.size();
+        out << "dleft-occupancy: crc " << total[0] << " (" << total[0] / regsize << "), rand ";
+        out << total[1] << " (" << total[1] / regsize << ")" << endl;
+    }
+};
+
+#endif
@@ -5,21 +5,26 @@
 #include <cmath>
 #include <vector>
 #include <cassert>
+#include <cstddef>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "model.h"
-#include "bloom-filter.h"
+#include "report.h"
+#include "bloom-epoch.h"
+#include "bloom-blocked.h"
+#include "hash-registers.h"
 
 using namespace std;
 
-struct tNodeHash {
-    tPrefix prefix;
-    bool valid = false;
-    uint64_t timestamp = 0;
-    uint64_t childvals[2] = {0, 0};
-    uint64_t summaryval = 0;
-
-    tNodeHash() = default;
-    tNodeHash(tPrefix pref): prefix(pref), valid(true) {}
+// Constants of a prefix length for hashing its level like tHash::hash32
+struct tHashLevel {
+    unsigned mask = 0;
+    tHashRange range;
+    uint64_t base = 0;
+    bool direct = true;
 };
 
 struct tModelHash : public tModel {
@@ -43,6 +48,10 @@ struct tModelHash : public tModel {
     bool hashcopt = true;
     bool hashadapt = false;
     bool hashskip = false;
+    bool hashbuckets = false;
+    bool blockedfilter = false;
+    bool compact = false;
+    tHashFamily hashfamily = HASH_STD;
     uint64_t div = 0;
 
     uint64_t collisions = 0;
@@ -51,16 +60,21 @@ struct tModelHash : public tModel {
     vector<uint64_t> memsizes;
     vector<uint64_t> thresholds;
 
-    vector<vector<bloom_filter>> filters;
+    vector<vector<tBloomEpoch>> filters;
+    vector<vector<tBloomBlocked>> blockedfilters;
     vector<uint64_t> filterstamps;
 
-    vector<vector<tNodeHash>> table;
+    tHashNodes nodes;
+    tHashRegisters registers;
+    tHashBuckets buckets;
+
+    tHashLevel hashlevels[32+1];
+    tHashLevels pktlevels;
 
     void init(uint64_t divider) {
         div = divider;
 
         if (flows) {
-            filters.resize(lastlen-firstlen+1);
             filterstamps.resize(lastlen-firstlen+1, 0);
 
             bloom_parameters params;
@@ -78,16 +92,16 @@ struct tModelHash : public tModel {
             // Compute optimal parameters again
             params.compute_optimal_parameters();
 
-            cout << "bloom-filter: ";
-            cout << params.optimal_parameters.number_of_hashes << " (" << optim_hashes << "), ";
-            cout << params.optimal_parameters.table_size << " (" << optim_size << ")" << endl;
-
-            // Instantiate Bloom Filter as a blueprint
-            bloom_filter filter(params);
+            ostream &out = report->text();
+            out << "bloom-filter: ";
+            out << params.optimal_parameters.number_of_hashes << " (" << optim_hashes << "), ";
+            out << params.optimal_parameters.table_size << " (" << optim_size << ")" << endl;
 
-            for (unsigned i = lastlen-1; i >= firstlen; i--) {
-                filters[lastlen-i].resize(2, filter);
-                if (divider == 0) break;
+            // Instantiate Bloom Filter as a blueprint, tables are allocated by first use
+            if (blockedfilter) {
+                blockedfilters.resize(lastlen-firstlen+1, vector<tBloomBlocked>(2, tBloomBlocked(params)));
+            } else {
+                filters.resize(lastlen-firstlen+1, vector<tBloomEpoch>(2, tBloomEpoch(params)));
             }
         }
 
@@ -101,12 +115,9 @@ struct tModelHash : public tModel {
         uint64_t memchun = (memory-((1UL << (memcoef+1))-2))/(lastlen-memcoef-firstlen+1);
         uint64_t memrest = (memory-((1UL << (memcoef+1))-2))%(lastlen-memcoef-firstlen+1);
 
-        table.resize(lastlen-firstlen+1);
-
         uint64_t memsize = memchun;
         if (memrest > 0) { memsize++; memrest--; }
         memsizes.push_back(memsize);
-        table[0].resize(memsize);
 
         for (unsigned i = lastlen-1; i >= firstlen; i--) {
 
@@ -124,11 +135,51 @@ struct tModelHash : public tModel {
             uint64_t memsize = (1UL << i) <= memchun ? (1UL << i) : memchun;
             if (memrest > 0) { memsize++; memrest--; }
             memsizes.push_back(memsize);
-            table[lastlen-i].resize(memsize);
         }
 
         for (unsigned i = 0; i < atimeouts.size(); i++) {
-            cout << i << ": " << atimeouts[i] << ", " << thresholds[i] << ", " << memsizes[i] << endl;
+            report->text() << i << ": " << atimeouts[i] << ", " << thresholds[i] << ", " << memsizes[i] << endl;
+        }
+
+        // Tables of all levels by prefix length
+        vector<uint64_t> sizes(memsizes.rbegin(), memsizes.rend());
+        if (hashbuckets) {
+            buckets.init(sizes, firstlen, itimeout);
+            report->text() << "buckets: " << buckets.bytes() << " bytes" << endl;
+        } else if (compact) {
+            registers.init(sizes, firstlen);
+            report->text() << "registers: " << registers.bytes() << " bytes" << endl;
+        } else {
+            nodes.init(sizes, firstlen);
+        }
+
+        for (unsigned len = firstlen; len <= lastlen; len++) {
+            tHashLevel &level = hashlevels[len];
+            level.mask = (len == 0) ? 0 : ~0U << (32-len);
+            level.range = tHashRange(getMemsize(len));
+            level.direct = (1UL << len) <= level.range.size;
+            level.base = hashbuckets ? buckets.base(len) : compact ? registers.base(len) : nodes.base(len);
+        }
+    }
+
+    // Hashes the prefixes of all lengths of the packet once into slots of
+    // the tables, indices match tHash::hash32 of each prefix
+    template<typename F>
+    void hashLevels(const tPacket &pkt) {
+        tHashLevels &lv = pktlevels;
+        unsigned addr = pkt.srcPrefix.prefix;
+        lv.lastbits = 0;
+
+        for (unsigned len = firstlen; len <= lastlen; len++) {
+            const tHashLevel &level = hashlevels[len];
+            unsigned prefix = addr & level.mask;
+            lv.prefix[len] = prefix;
+
+            uint64_t index = (uint64_t) prefix >> (32-len);
+            bool lastbit = len > 0 && (index & 1);
+            if (!level.direct) index = level.range.index(F::hash(prefix, len), lastbit);
+            lv.slot[len] = level.base + index;
+            if (lastbit) lv.lastbits |= 1UL << len;
         }
     }
 
@@ -161,8 +212,15 @@ struct tModelHash : public tModel {
 
     void filter(unsigned &cincrement, unsigned &sincrement, const tPacket &pkt, const tPrefix &currpref, unsigned currlen, bool child) {
         int index = (div > 0) ? lastlen-currlen : 1;
-        vector<bloom_filter> &filter = filters[index];
-        uint64_t &filterstamp = filterstamps[index];
+        if (blockedfilter) {
+            filter(blockedfilters[index], filterstamps[index], cincrement, sincrement, pkt, currpref, currlen, child);
+        } else {
+            filter(filters[index], filterstamps[index], cincrement, sincrement, pkt, currpref, currlen, child);
+        }
+    }
+
+    template<typename F>
+    void filter(vector<F> &filter, uint64_t &filterstamp, unsigned &cincrement, unsigned &sincrement, const tPacket &pkt, const tPrefix &currpref, unsigned currlen, bool child) {
 
         // Filter invalid?
         if (filterstamp + getAtimeout(currlen) <= pkt.timestamp) {
@@ -195,58 +253,63 @@ struct tModelHash : public tModel {
     }
 
     virtual bool processPacket(tPacket &pkt) override {
+        if (hashbuckets) return processPacket(buckets, pkt);
+        return compact ? processPacket(registers, pkt) : processPacket(nodes, pkt);
+    }
+
+    // Packet update of the tables in the layout of the registers
+    template<typename R>
+    bool processPacket(R &regs, tPacket &pkt) {
 
         if (timestamp == 0) {
             timestamp = pkt.timestamp + itimeout;
-            cout << "start: " << pkt.timestamp << endl;
+            report->text() << "start: " << pkt.timestamp << endl;
         }
 
 //        cout << pkt.srcPrefix.str() << endl;
 //        cout << table.size() << endl;
 
-        tPrefix currpref; tNodeHash *currptr;
-        unsigned curridx, currlen = firstlen;
+        tPrefix currpref; uint64_t currslot = 0;
+        bool found = false;
+        unsigned currlen = firstlen;
+
+        // Hash all prefix lengths of the packet
+        switch (hashfamily) {
+            case HASH_CRC32: hashLevels<tHashCrc32>(pkt); break;
+            case HASH_CRC32C: hashLevels<tHashCrc32c>(pkt); break;
+            case HASH_MULSHIFT: hashLevels<tHashMulShift>(pkt); break;
+            case HASH_TABULATION: hashLevels<tHashTabulation>(pkt); break;
+            default: hashLevels<tHashStd>(pkt); break;
+        }
+        tHashLevels &lv = pktlevels;
+        regs.masks(lv, firstlen, lastlen, pkt.timestamp, itimeout, newinvalidation);
+        uint64_t mismatch = lv.lastbits ^ lv.nodebits;
 
         // Lookup a valid prefix
         for (unsigned len = lastlen; len >= firstlen; len--) {
             currpref = pkt.srcPrefix/len;
-            curridx = tHash::hash32(currpref, getMemsize(len));
-
-//            cout << endl;
-//            cout << len << endl;
-//            cout << currpref.str() << endl;
-//            cout << getMemsize(len) << endl;
-//            cout << curridx << endl;
-
-            currptr = &(table[lastlen-len][curridx]);
-            if ((newinvalidation && currptr->valid) || (!newinvalidation && currptr->timestamp + itimeout > pkt.timestamp)) {
+            currslot = lv.slot[len];
+            found = lv.valid & (1UL << len);
+            if (found) {
                 currlen = len;
-                if (hashadapt && !(currptr->prefix == currpref)) {
-                    currptr = nullptr; continue;
+                if (hashadapt && !regs.match(currslot, currpref)) {
+                    found = false; continue;
                 }
                 if (!hashcopt) break;
-                for (unsigned l = len; l >= firstlen; l--) {
-                    tPrefix temppref = pkt.srcPrefix/l;
-                    unsigned tempidx = tHash::hash32(temppref, getMemsize(l));
-                    if (table[lastlen-l][tempidx].prefix[l-1] != temppref[l-1]) {
-                        currptr = nullptr; break;
-                    }
-                }
-                if (currptr != nullptr) break;
-            } else {
-                currptr = nullptr;
+                uint64_t lens = ((2UL << len) - 1) & ~((1UL << firstlen) - 1);
+                if ((mismatch & lens) == 0) break;
+                found = false;
             }
         }
 
         // Not found, insert new node as the root
-        if (currptr == nullptr) {
-            curridx = tHash::hash32(currpref, getMemsize(firstlen));
-            currptr = &(table[lastlen-firstlen][curridx] = tNodeHash(currpref));
-            currptr->timestamp = pkt.timestamp;
+        if (!found) {
+            currslot = lv.slot[firstlen];
+            regs.reset(currslot, currpref, pkt.timestamp, 0, 0, 0);
         }
 
         // Report collision
-        if (!(currptr->prefix == currpref)) {
+        if (!regs.match(currslot, currpref)) {
             collisions++;
 //            cout << "COLLISION !!! " << currptr->prefix.str() << " " << currpref.str() << endl;
 //
@@ -274,7 +337,6 @@ struct tModelHash : public tModel {
         if (currlen == lastlen) nextlen = lastlen;
 
         // Create shortcuts
-        tNodeHash &currnode = *currptr;
         bool currchild = pkt.srcPrefix[currlen];
         tPrefix prevpref = pkt.srcPrefix/prevlen;
         tPrefix nextpref = pkt.srcPrefix/nextlen;
@@ -284,79 +346,66 @@ struct tModelHash : public tModel {
         unsigned sincrement = cincrement;
 
         // Collison detected? Skip and do nothing :-)
-        if (hashskip && !(currptr->prefix == currpref)) {
+        if (hashskip && !regs.match(currslot, currpref)) {
 
         // Prefix node inactive timeout (invalidation)?
-        } else if (newinvalidation && currnode.timestamp + itimeout <= pkt.timestamp) {
+        } else if (newinvalidation && regs.timestamp(currslot) + itimeout <= pkt.timestamp) {
 
             // Report invalidation
             if (reports)
-                cout << "timestamp: " << pkt.timestamp << ", event: invalid, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_INVALID, currpref, regs.summaryval(currslot));
 
             // Erase (invalidate) current prefix node
-            currptr->timestamp = 0;
-            currptr->valid = false;
+            regs.invalidate(currslot);
 
         // Prefix node (active) timeout?
-        } else if (currnode.timestamp + getAtimeout(currlen) <= pkt.timestamp) {
+        } else if (regs.timestamp(currslot) + getAtimeout(currlen) <= pkt.timestamp) {
 
             // Keep the rule?
-            if (currnode.summaryval >= getThreshold(currlen)) {
+            if (regs.summaryval(currslot) >= getThreshold(currlen)) {
 
                 // Report hierarchical Heavy-Hitter
-                cout << "timestamp: " << pkt.timestamp << ", event: hhh, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_HHH, currpref, regs.summaryval(currslot));
 
                 // Reset current prefix node
-                currnode = tNodeHash(currpref);
                 if (flows) filter(cincrement, sincrement, pkt, currpref, currlen, currchild);
-                currnode.childvals[currchild] = cincrement;
-                currnode.summaryval = sincrement;
-                currnode.timestamp = pkt.timestamp;
+                regs.reset(currslot, currpref, pkt.timestamp, currchild, cincrement, sincrement);
 
             // Collapse rule?
             } else {
 
                 // Report collapsing
                 if (reports)
-                    cout << "timestamp: " << pkt.timestamp << ", event: collapse, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                    report->event(pkt.timestamp, EVENT_COLLAPSE, currpref, regs.summaryval(currslot));
 
                 // Erase (invalidate) current prefix node
-                currptr->timestamp = 0;
-                currptr->valid = false;
+                regs.invalidate(currslot);
 
                 // Insert a new prefix node
                 bool prevchild = pkt.srcPrefix[prevlen];
-                tNodeHash &prevnode = table[lastlen-prevlen][tHash::hash32(prevpref, getMemsize(prevlen))] = tNodeHash(prevpref);
                 if (flows) filter(cincrement, sincrement, pkt, prevpref, prevlen, prevchild);
-                prevnode.childvals[prevchild] = cincrement;
-                prevnode.summaryval = sincrement;
-                prevnode.timestamp = pkt.timestamp;
+                regs.reset(lv.slot[prevlen], prevpref, pkt.timestamp, prevchild, cincrement, sincrement);
             }
 
         // Expand rule?
-        } else if (currnode.childvals[currchild] >= getThreshold(currlen) && currlen != lastlen) {
+        } else if (regs.childval(currslot, currchild) >= getThreshold(currlen) && currlen != lastlen) {
 
             // Report pure Heavy-Hitter
             if (pureheavy || reports)
-                cout << "timestamp: " << pkt.timestamp << ", event: expand, prefix_found: " << nextpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_EXPAND, nextpref, regs.summaryval(currslot));
 
             // Subtract HH value from current prefix node
-            currnode.childvals[currchild] = 0;
-            currnode.summaryval = currnode.childvals[!currchild];
+            regs.set(currslot, currchild, 0, regs.childval(currslot, !currchild));
 
             // Insert a new prefix node
             bool nextchild = pkt.srcPrefix[nextlen];
-            tNodeHash &nextnode = table[lastlen-nextlen][tHash::hash32(nextpref, getMemsize(nextlen))] = tNodeHash(nextpref);
             if (flows) filter(cincrement, sincrement, pkt, nextpref, nextlen, nextchild);
-            nextnode.childvals[nextchild] = cincrement;
-            nextnode.summaryval = sincrement;
-            nextnode.timestamp = pkt.timestamp;
+            regs.reset(lv.slot[nextlen], nextpref, pkt.timestamp, nextchild, cincrement, sincrement);
 
         // Basic update
         } else {
             if (flows) filter(cincrement, sincrement, pkt, currpref, currlen, currchild);
-            currnode.childvals[currchild] += cincrement;
-            currnode.summaryval += sincrement;
+            regs.add(currslot, currchild, cincrement, sincrement);
         }
 
         return true;
@@ -366,7 +415,8 @@ struct tModelHash : public tModel {
     }
 
     virtual void flush() override {
-        cout << "collisions: " << collisions << endl;
+        report->text() << "collisions: " << collisions << endl;
+        if (hashbuckets) report->text() << "evictions: " << buckets.evictions() << endl;
     }
 };
 
@@ -1,21 +1,70 @@
 #ifndef MODEL_OFFLINE_H_
 #define MODEL_OFFLINE_H_
 
-#include <map>
-#include <set>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <iterator>
+#include <algorithm>
 
 #include "model.h"
+#include "report.h"
+#include "distinct.h"
 
 using namespace std;
 
+const size_t OFFLINE_PARALLEL = 1UL << 16;
+
 struct tNodeOffline {
+    unsigned prefix = 0;
     bool hh = false;
     bool hhh = false;
     uint64_t hhvalue = 0;
     uint64_t hhhvalue = 0;
-    set<tPrefix> filter;
+    tDistinct filter;
+};
+
+// Open addressing index of prefixes into a dense array of nodes, linear
+// probing in a table kept at most half full
+struct tIndexOffline {
+    vector<uint32_t> slots; // Node position plus one, zero when free
+    vector<tNodeOffline> nodes;
+    unsigned shift = 32;
+
+    inline tNodeOffline &operator[](unsigned prefix) {
+        if (2 * (nodes.size() + 1) > slots.size()) grow();
+        uint32_t mask = slots.size() - 1;
+        for (uint32_t idx = (prefix * 0x9E3779B1U) >> shift; ; idx = (idx + 1) & mask) {
+            if (slots[idx] == 0) {
+                nodes.push_back(tNodeOffline());
+                nodes.back().prefix = prefix;
+                slots[idx] = nodes.size();
+                return nodes.back();
+            }
+            if (nodes[slots[idx] - 1].prefix == prefix) return nodes[slots[idx] - 1];
+        }
+    }
+
+    void grow() {
+        size_t size = max<size_t>(slots.size() * 2, 1024);
+        shift = 32 - __builtin_ctzl(size);
+        slots.assign(size, 0);
+        for (size_t pos = 0; pos < nodes.size(); pos++) {
+            uint32_t idx = (nodes[pos].prefix * 0x9E3779B1U) >> shift;
+            while (slots[idx] != 0) idx = (idx + 1) & (size - 1);
+            slots[idx] = pos + 1;
+        }
+    }
+
+    void clear() {
+        fill(slots.begin(), slots.end(), 0);
+        nodes.clear();
+    }
 };
 
+// Exact offline model, counters of the last level are aggregated in a flat
+// index during the window; flush() sorts them once and builds every upper
+// level by a linear reduce of the level below, in parallel for large levels
 struct tModelOffline : public tModel {
 
     uint64_t timeout = 0;
@@ -29,12 +78,15 @@ struct tModelOffline : public tModel {
     bool reports = false;
     bool collapseacc = false;
     bool firstshot = false;
+    unsigned threads = 1;
+    unsigned precision = 0; // HyperLogLog precision of distinct flows, zero counts exactly
 
     uint64_t timestamp = 0;
     uint64_t pcktscounter = 0;
     uint64_t bytescounter = 0;
-    set<tPrefix> flowscounter;
-    map<tPrefix,tNodeOffline> tree;
+    tDistinct flowscounter;
+    tIndexOffline leaves;
+    vector<vector<tNodeOffline>> levels; // By prefix length
 
     virtual bool processPacket(tPacket &pkt) override {
         if (timeout != 0 && timestamp != 0 && timestamp <= pkt.timestamp) {
@@ -45,25 +97,19 @@ struct tModelOffline : public tModel {
 
         pcktscounter += 1;
         bytescounter += pkt.length;
-        flowscounter.insert(pkt.dstPrefix);
+        flowscounter.insert(key(pkt.dstPrefix), precision);
 
         if (timestamp == 0) {
             timestamp = pkt.timestamp + timeout;
-            cout << "start: " << pkt.timestamp << endl;
-        }
-
-        tPrefix prefix = pkt.srcPrefix/lastlen;
-        auto it = tree.find(prefix);
-        if (it == tree.end()) {
-            it = tree.insert(pair<tPrefix,tNodeOffline>(prefix, tNodeOffline())).first;
+            report->text() << "start: " << pkt.timestamp << endl;
         }
 
+        tNodeOffline &node = leaves[(pkt.srcPrefix/lastlen).prefix];
         if (flows) {
-            it->second.filter.insert(pkt.dstPrefix);
-            it->second.hhhvalue = it->second.filter.size();
+            node.filter.insert(key(pkt.dstPrefix), precision);
         } else {
-            it->second.hhvalue += bytes ? pkt.length : 1;
-            it->second.hhhvalue += bytes ? pkt.length : 1;
+            node.hhvalue += bytes ? pkt.length : 1;
+            node.hhhvalue += bytes ? pkt.length : 1;
         }
 
         return true;
@@ -72,73 +118,124 @@ struct tModelOffline : public tModel {
     virtual void clear() override {
         pcktscounter = 0;
         bytescounter = 0;
-        flowscounter.clear();
-        tree.clear();
+        flowscounter = tDistinct();
+        leaves.clear();
+        levels.clear();
+    }
+
+    // Distinct flows key of the prefix
+    static inline uint64_t key(const tPrefix &prefix) {
+        return (uint64_t) prefix.length << 32 | prefix.prefix;
+    }
+
+    // Marks heavy-hitters of the children and adds them into their parents of
+    // the length, the children are sorted and so the parents become
+    void reduce(vector<tNodeOffline>::iterator begin, vector<tNodeOffline>::iterator end,
+                unsigned len, bool parents, vector<tNodeOffline> &level) {
+        unsigned mask = (len == 0) ? 0 : ~0U << (32-len);
+        for (auto it = begin; it != end; it++) {
+            if (flows) it->hhhvalue = it->filter.count();
+            it->hh = it->hhvalue >= threshold;
+            it->hhh = it->hhhvalue >= threshold;
+            if (!parents) continue;
+
+            if (level.empty() || level.back().prefix != (it->prefix & mask)) {
+                level.push_back(tNodeOffline());
+                level.back().prefix = it->prefix & mask;
+            }
+            tNodeOffline &par = level.back();
+            if (flows) {
+                if (!it->hhh) par.filter.merge(it->filter);
+            } else {
+                par.hhvalue += it->hhvalue;
+                if (!it->hhh) par.hhhvalue += it->hhhvalue;
+            }
+        }
+    }
+
+    // Reduces the level of the length into the level above, large levels are
+    // split among threads at boundaries of their parents
+    void reduce(unsigned len) {
+        vector<tNodeOffline> &children = levels[len];
+        bool parents = len > firstlen;
+        vector<tNodeOffline> *level = parents ? &levels[len-1] : nullptr;
+        vector<tNodeOffline> none;
+
+        size_t parts = (threads > 1 && children.size() >= OFFLINE_PARALLEL) ? threads : 1;
+        if (parts == 1) return reduce(children.begin(), children.end(), len-1, parents, parents ? *level : none);
+
+        unsigned mask = (len <= 1) ? 0 : ~0U << (33-len);
+        vector<size_t> bounds(parts + 1, children.size());
+        bounds[0] = 0;
+        for (size_t part = 1; part < parts; part++) {
+            size_t pos = max(bounds[part-1], children.size() * part / parts);
+            while (pos > bounds[part-1] && pos < children.size() &&
+                   (children[pos].prefix & mask) == (children[pos-1].prefix & mask)) pos++;
+            bounds[part] = pos;
+        }
+
+        vector<vector<tNodeOffline>> results(parts);
+        vector<thread> workers;
+        for (size_t part = 0; part < parts; part++) {
+            workers.emplace_back([this, &children, &bounds, &results, part, len, parents] {
+                reduce(children.begin() + bounds[part], children.begin() + bounds[part+1], len-1, parents, results[part]);
+            });
+        }
+        for (thread &worker: workers) worker.join();
+        if (!parents) return;
+        for (auto &result: results) move(result.begin(), result.end(), back_inserter(*level));
     }
 
     virtual void flush() override {
         if (quotient != 0.0) {
-            if (flows) threshold = quotient * flowscounter.size();
+            if (flows) threshold = quotient * flowscounter.count();
             else if (bytes) threshold = quotient * bytescounter;
             else threshold = quotient * pcktscounter;
         }
 
-        // Build hierarchy
-        for (auto it = tree.rbegin(); it != tree.rend(); it++) {
-            it->second.hh = it->second.hhvalue >= threshold;
-            it->second.hhh = it->second.hhhvalue >= threshold;
-
-            if (it->first.length > firstlen) {
-                tNodeOffline node; tPrefix prefix = it->first;
-                prefix.length -= 1; prefix.norm();
-
-                auto par = tree.find(prefix);
-                if (par == tree.end()) {
-                    par = tree.insert(pair<tPrefix,tNodeOffline>(prefix, node)).first;
-                }
-
-                if (flows) {
-                    if (!it->second.hhh) {
-                        par->second.filter.insert(it->second.filter.begin(), it->second.filter.end());
-                        par->second.hhhvalue = par->second.filter.size();
-                    }
-                } else {
-                    par->second.hhvalue += it->second.hhvalue;
-                    if (!it->second.hhh) par->second.hhhvalue += it->second.hhhvalue;
-                }
-            }
-        }
+        // Build hierarchy from the sorted last level
+        levels.assign(lastlen + 1, vector<tNodeOffline>());
+        levels[lastlen].swap(leaves.nodes);
+        leaves.clear();
+        sort(levels[lastlen].begin(), levels[lastlen].end(), [](const tNodeOffline &a, const tNodeOffline &b) {
+            return a.prefix < b.prefix;
+        });
+        for (unsigned len = lastlen; len >= firstlen && len <= lastlen; len--) reduce(len);
 
         // Hierarchy heavy-hitters list
-        for (auto it = tree.begin(); it != tree.end(); it++) {
-            if (!it->second.hhh) continue;
-            cout << "timestamp: " << timestamp << ", hhh: 1, prefix: " << it->first.str() << ", value: " << it->second.hhhvalue << endl;
+        tPrefix prefix;
+        for (unsigned len = firstlen; len <= lastlen; len++) for (const tNodeOffline &node: levels[len]) {
+            if (!node.hhh) continue;
+            prefix.length = len; prefix.prefix = node.prefix;
+            report->event(timestamp, EVENT_WINDOW_HHH, prefix, node.hhhvalue);
         }
 
         // Heavy-hitters list
         if (pureheavy) {
-            for (auto it = tree.begin(); it != tree.end(); it++) {
-                if (!it->second.hh) continue;
-                cout << "timestamp: " << timestamp << ", hhh: 0, prefix: " << it->first.str() << ", value: " << it->second.hhvalue << endl;
+            for (unsigned len = firstlen; len <= lastlen; len++) for (const tNodeOffline &node: levels[len]) {
+                if (!node.hh) continue;
+                prefix.length = len; prefix.prefix = node.prefix;
+                report->event(timestamp, EVENT_WINDOW_HH, prefix, node.hhvalue);
             }
         }
 
         // Report counters
-        if (reports) {
-            for (auto it = tree.begin(); it != tree.end(); it++) {
-                if (it->first.length != 32) continue;
-                cout << "timestamp," << timestamp << ",report,prefix," << it->first.str() << ",value," << it->second.hhvalue << endl;
+        if (reports && lastlen == 32) {
+            for (const tNodeOffline &node: levels[lastlen]) {
+                prefix.length = lastlen; prefix.prefix = node.prefix;
+                report->event(timestamp, EVENT_COUNTER, prefix, node.hhvalue);
             }
         }
 
         // Print time window stats
-        cout << "bytes counter: " << bytescounter << endl;
-        if (timeout != 0) cout << "bytes speed: " << (double) bytescounter / (timeout / 1000000) << endl;
-        cout << "packets counter: " << pcktscounter << endl;
-        if (timeout != 0) cout << "packets speed: " << (double) pcktscounter / (timeout / 1000000) << endl;
-        cout << "flows counter: " << flowscounter.size() << endl;
-        if (timeout != 0) cout << "flows speed: " << (double) flowscounter.size() / (timeout / 1000000) << endl;
-        if (quotient != 0.0) cout << "threshold: " << threshold << endl;
+        ostream &out = report->text();
+        out << "bytes counter: " << bytescounter << endl;
+        if (timeout != 0) out << "bytes speed: " << (double) bytescounter / (timeout / 1000000) << endl;
+        out << "packets counter: " << pcktscounter << endl;
+        if (timeout != 0) out << "packets speed: " << (double) pcktscounter / (timeout / 1000000) << endl;
+        out << "flows counter: " << flowscounter.count() << endl;
+        if (timeout != 0) out << "flows speed: " << (double) flowscounter.count() / (timeout / 1000000) << endl;
+        if (quotient != 0.0) out << "threshold: " << threshold << endl;
     }
 };
 
@@ -1,11 +1,13 @@
 #ifndef MODEL_ONLINE_H_
 #define MODEL_ONLINE_H_
 
-#include <map>
 #include <vector>
 #include <cassert>
 
 #include "model.h"
+#include "report.h"
+#include "prefix-trie.h"
+#include "flow-filter.h"
 
 using namespace std;
 
@@ -31,17 +33,20 @@ struct tModelOnline : public tModel {
     bool bytes = true;
     bool flows = false;
     bool reports = false;
+    bool trie = false;
+    size_t filterslots = FLOW_FILTER_LIMIT;
 
     vector<uint64_t> atimeouts;
     vector<uint64_t> thresholds;
 
-    vector<map<tPrefix,map<tPrefix,bool[2]>>> filters;
+    vector<tFlowFilter> filters;
     vector<uint64_t> filterstamps;
 
-    map<tPrefix,tNodeOnline> tree;
+    tPrefixTrie<tNodeOnline> tree;
 
     void init(uint64_t divider) {
-        filters.resize(lastlen-firstlen+1);
+        tree.init(trie);
+        filters.resize(lastlen-firstlen+1, tFlowFilter(filterslots));
         filterstamps.resize(lastlen-firstlen+1, 0);
 
         if (speed == 0) return;
@@ -59,7 +64,7 @@ struct tModelOnline : public tModel {
         }
 
         for (unsigned i = 0; i < atimeouts.size(); i++) {
-            cout << i << ": " << atimeouts[i] << ", " << thresholds[i] << endl;
+            report->text() << i << ": " << atimeouts[i] << ", " << thresholds[i] << endl;
         }
     }
 
@@ -78,7 +83,7 @@ struct tModelOnline : public tModel {
     }
 
     void filter(unsigned &cincrement, unsigned &sincrement, const tPacket &pkt, const tPrefix &currpref, unsigned currlen, bool child) {
-        map<tPrefix,map<tPrefix,bool[2]>> &filter = filters[lastlen-currlen];
+        tFlowFilter &filter = filters[lastlen-currlen];
         uint64_t &filterstamp = filterstamps[lastlen-currlen];
 
         // Filter invalid?
@@ -87,56 +92,60 @@ struct tModelOnline : public tModel {
             if (filterstamp + getAtimeout(currlen) <= pkt.timestamp)
                 filterstamp = pkt.timestamp;
 
-            //uint64_t uniquesrcdst = 0;
-            //cout << "filter: layer " << (lastlen-currlen) << ", ";
-            //for (auto it = filter.begin(); it != filter.end(); it++) {
-            //    uniquesrcdst += it->second.size();
-            //} cout << "count: " << uniquesrcdst << endl;
+            // Filter overflowed its slots in the last window?
+            if (filter.approximate())
+                report->text() << "filter-full: layer " << (lastlen-currlen) << endl;
 
             filter.clear();
         }
 
-        // Get destination IP filter
-        map<tPrefix,bool[2]> &dstfilter = filter[currpref];
-        auto *flags = dstfilter[pkt.dstPrefix];
-
-        //cout << (int) flags[0] << (int) flags[1] << endl;
+        // Get flags of source prefix and destination IP
+        uint8_t &flags = filter.flags(currpref, pkt.dstPrefix);
 
         // Check children flags
-        if (flags[0] || flags[1]) sincrement = 0;
-        if (flags[child]) cincrement = 0;
+        if (flags != 0) sincrement = 0;
+        if (flags & (1 << child)) cincrement = 0;
 
         // Update filter
-        flags[child] = true;
+        flags |= 1 << child;
     }
 
     virtual bool processPacket(tPacket &pkt) override {
 
         if (timestamp == 0) {
             timestamp = pkt.timestamp + repgran;
-            cout << "start: " << pkt.timestamp << endl;
+            report->text() << "start: " << pkt.timestamp << endl;
         }
 
-        map<tPrefix,tNodeOnline>::iterator currit;
+        tPrefixTrie<tNodeOnline>::tEntry *currit = nullptr;
         tPrefix currpref; unsigned currlen = firstlen;
 
         // Lookup a valid prefix
-        for (unsigned len = lastlen; len >= firstlen; len--) {
+        if (trie) {
+            while ((currit = tree.lookup(pkt.srcPrefix)) != nullptr) {
+                currpref = currit->first;
+                if (newinvalidation || currit->second.timestamp + itimeout > pkt.timestamp) {
+                    currlen = currpref.length; break;
+                }
+                tree.erase(currit);
+            }
+            if (currit == nullptr) currpref = pkt.srcPrefix/firstlen;
+        } else for (unsigned len = lastlen; len >= firstlen; len--) {
             currpref = pkt.srcPrefix/len;
             currit = tree.find(currpref);
-            if (currit != tree.end()) {
+            if (currit != nullptr) {
                 if (newinvalidation || currit->second.timestamp + itimeout > pkt.timestamp) {
                     currlen = len; break;
                 } else {
                     tree.erase(currit);
-                    currit = tree.end();
+                    currit = nullptr;
                 }
             }
         }
 
         // Not found, insert new node as the root
-        if (currit == tree.end()) {
-            currit = tree.insert(pair<tPrefix,tNodeOnline>(currpref, tNodeOnline())).first;
+        if (currit == nullptr) {
+            currit = tree.insert(currpref);
             currit->second.timestamp = pkt.timestamp;
         }
 
@@ -161,7 +170,7 @@ struct tModelOnline : public tModel {
 
             // Report invalidation
             if (reports)
-                cout << "timestamp: " << pkt.timestamp << ", event: invalid, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_INVALID, currpref, currnode.summaryval);
 
             // Erase current prefix node
             tree.erase(currit);
@@ -173,7 +182,7 @@ struct tModelOnline : public tModel {
             if (currnode.summaryval >= getThreshold(currlen)) {
 
                 // Report hierarchical Heavy-Hitter
-                cout << "timestamp: " << pkt.timestamp << ", event: hhh, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_HHH, currpref, currnode.summaryval);
 
                 // Reset current prefix node
                 currnode = tNodeOnline();
@@ -186,14 +195,15 @@ struct tModelOnline : public tModel {
             } else {
 
                 // Erase current prefix node
+                uint64_t summaryval = currnode.summaryval;
                 tree.erase(currit);
 
                 // Report collapsing
                 if (reports) {
-                    if (tree.find(prevpref) == tree.end()) {
-                        cout << "timestamp: " << pkt.timestamp << ", event: move, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                    if (tree.find(prevpref) == nullptr) {
+                        report->event(pkt.timestamp, EVENT_MOVE, currpref, summaryval);
                     } else {
-                        cout << "timestamp: " << pkt.timestamp << ", event: collapse, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                        report->event(pkt.timestamp, EVENT_COLLAPSE, currpref, summaryval);
                     }
                 }
 
@@ -214,7 +224,7 @@ struct tModelOnline : public tModel {
 
             // Report pure Heavy-Hitter
             if (pureheavy || reports)
-                cout << "timestamp: " << pkt.timestamp << ", event: expand, prefix_found: " << currpref.str() << ", value: " << currnode.summaryval << endl;
+                report->event(pkt.timestamp, EVENT_EXPAND, currpref, currnode.summaryval);
 
             // Subtract HH value from current prefix node
             currnode.childvals[currchild] = 0;
@@ -222,7 +232,7 @@ struct tModelOnline : public tModel {
 
             // Insert a new prefix node
             bool nextchild = pkt.srcPrefix[nextlen];
-            tNodeOnline &nextnode = tree.insert(pair<tPrefix,tNodeOnline>(nextpref, tNodeOnline())).first->second;
+            tNodeOnline &nextnode = tree[nextpref];
             if (flows) filter(cincrement, sincrement, pkt, nextpref, nextlen, nextchild);
             nextnode.childvals[nextchild] = cincrement;
             nextnode.summaryval = sincrement;
@@ -249,21 +259,22 @@ struct tModelOnline : public tModel {
             }
 
             unsigned memdepth[2] = {0};
+            ostream &out = report->text();
 
-            cout << "histogram-incl:";
+            out << "histogram-incl:";
             for (unsigned i = 0; i <= 32; i++) {
-                cout << " " << i << ":" << histgram[0][i];
+                out << " " << i << ":" << histgram[0][i];
                 if (histgram[0][i] > 0) memdepth[0] = i;
-            } cout << endl;
+            } out << endl;
 
-            cout << "histogram-excl:";
+            out << "histogram-excl:";
             for (unsigned i = 0; i <= 32; i++) {
-                cout << " " << i << ":" << histgram[1][i];
+                out << " " << i << ":" << histgram[1][i];
                 if (histgram[1][i] > 0) memdepth[1] = i;
-            } cout << endl;
+            } out << endl;
 
-            cout << "memory-occup: " << tree.size() << "/" << memocc << endl;
-            cout << "memory-depth: " << memdepth[0] << "/" << memdepth[1] << endl;
+            out << "memory-occup: " << tree.size() << "/" << memocc << endl;
+            out << "memory-depth: " << memdepth[0] << "/" << memdepth[1] << endl;
 
             timestamp += repgran;
         }
@@ -0,0 +1,286 @@
+#ifndef MODEL_P4_H_
+#define MODEL_P4_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <byteswap.h>
+
+#include "model.h"
+#include "report.h"
+#include "output.h"
+
+using namespace std;
+
+// Constants of hhh.p4
+const unsigned HHH_TABCOUNT = 32;
+const uint32_t HHH_TABSIZE = 8192;
+const uint32_t HHH_THRESHOLD = 10000;
+const uint64_t HHH_ATIMEOUT = 10000000;
+const uint64_t HHH_ITIMEOUT = 60000000;
+const uint8_t HHH_FIRSTLEN = 16;
+const uint8_t HHH_LASTLEN = 32;
+
+const uint64_t P4_TIME_MASK = (1UL << 48) - 1;
+const unsigned P4_DIGEST_SAMPLES = 1024;
+
+// Digest of hhh_digest_t as packed by bmv2, fields in network order
+struct __attribute__ ((packed)) tP4Digest {
+    uint32_t value;
+    uint32_t vector;
+    uint16_t timehi;
+    uint32_t timelo;
+    uint32_t prefix;
+    uint8_t length;
+};
+
+// Learning notification header of bmv2, in host order
+struct __attribute__ ((packed)) tP4DigestHeader {
+    char topic[4];
+    int32_t switchid;
+    int32_t cxtid;
+    int32_t listid;
+    uint64_t bufferid;
+    uint32_t samples;
+    char padding[4];
+};
+
+// Entry of a ternary table, lower priority values match first like bmv2
+struct tP4Ternary {
+    uint32_t value;
+    uint32_t mask;
+    int priority;
+    uint8_t params[3];
+};
+
+// Emulation of the hhh.p4 pipeline on the switch registers: 48-bit time
+// and register arithmetic, 32-bit counters, CRC-32 or identity indices of
+// all levels, the lookup_tab ternary match on the vector of valid stages
+// and the cfg_* registers. Table entries and register writes are loaded
+// from a runtime CLI file like hhh.config, digests are written in the
+// notification layout read by digest_client.py. Switch time starts at the
+// first packet of the trace.
+struct tModelP4 : public tModel {
+    uint32_t tabsize = HHH_TABSIZE;
+    const char *digestfile = nullptr;
+
+    // Config registers, zero selects the defaults of hhh.p4
+    uint32_t cfg_threshold = 0;
+    uint64_t cfg_timeouts[2] = {0, 0};
+    uint8_t cfg_prefixes[2] = {0, 0};
+
+    vector<tP4Ternary> lookup_tab;
+
+    // Memory registers
+    vector<uint64_t> vld_timestamp_reg;
+    vector<uint64_t> cnt_timestamp_reg;
+    vector<uint32_t> cnt_value_reg;
+
+    uint64_t start = 0;
+    bool started = false;
+    uint64_t digests = 0;
+
+    unique_ptr<tOutput> output;
+    vector<tP4Digest> samples;
+    uint64_t bufferid = 0;
+
+    void init(const char *configfile) {
+        if (configfile != nullptr) load(configfile);
+        stable_sort(lookup_tab.begin(), lookup_tab.end(), [](const tP4Ternary &a, const tP4Ternary &b) {
+            return a.priority < b.priority;
+        });
+
+        uint32_t regsize = tabsize * HHH_TABCOUNT + 1;
+        vld_timestamp_reg.assign(regsize, 0);
+        cnt_timestamp_reg.assign(regsize, 0);
+        cnt_value_reg.assign(regsize, 0);
+
+        if (digestfile != nullptr) output.reset(new tOutput(digestfile));
+        report->text() << "p4-registers: " << regsize << ", lookup-entries: " << lookup_tab.size() << endl;
+    }
+
+    // Reads lookup_tab entries and cfg_* register writes, other commands
+    // are ignored
+    void load(const char *filename) {
+        ifstream file(filename);
+        if (!file) throw runtime_error(string("opening P4 config file '") + filename + "' failed");
+
+        string line;
+        while (getline(file, line)) {
+            istringstream in(line);
+            string command, name;
+            in >> command >> name;
+            name = name.substr(name.rfind('.') + 1);
+
+            if (command == "table_add" && name == "lookup_tab") {
+                string action, key, arrow;
+                unsigned prev, curr, next;
+                tP4Ternary entry;
+                in >> action >> key >> arrow >> prev >> curr >> next >> entry.priority;
+                size_t pos = key.find("&&&");
+                if (!in || arrow != "=>" || pos == string::npos)
+                    throw runtime_error("invalid P4 config line '" + line + "'");
+                entry.value = stoul(key.substr(0, pos), nullptr, 0);
+                entry.mask = stoul(key.substr(pos + 3), nullptr, 0);
+                entry.params[0] = prev; entry.params[1] = curr; entry.params[2] = next;
+                lookup_tab.push_back(entry);
+            } else if (command == "register_write") {
+                unsigned index; uint64_t value;
+                in >> index >> value;
+                if (!in || index > 1) throw runtime_error("invalid P4 config line '" + line + "'");
+                if (name == "cfg_threshold_reg" && index == 0) cfg_threshold = value;
+                else if (name == "cfg_timeouts_reg") cfg_timeouts[index] = value & P4_TIME_MASK;
+                else if (name == "cfg_prefixes_reg") cfg_prefixes[index] = value;
+            }
+        }
+    }
+
+    // Register index of the prefix length, unknown lengths use the last register
+    inline uint32_t index(const uint32_t *hashes, uint8_t len) const {
+        return (len >= 1 && len <= HHH_TABCOUNT) ? hashes[len] : tabsize * HHH_TABCOUNT;
+    }
+
+    // Prefix of the length as built by read_data, shifts by the width give zero
+    static inline uint32_t prefix(uint32_t addr, uint8_t len) {
+        return (len == 0) ? 0 : addr & (~0U << (32 - len));
+    }
+
+    virtual bool processPacket(tPacket &pkt) override {
+        if (!started) {
+            start = pkt.timestamp;
+            started = true;
+        }
+
+        // init: configuration with defaults
+        uint32_t threshold = cfg_threshold ? cfg_threshold : HHH_THRESHOLD;
+        uint64_t atimeout = cfg_timeouts[0] ? cfg_timeouts[0] : HHH_ATIMEOUT;
+        uint64_t itimeout = cfg_timeouts[1] ? cfg_timeouts[1] : HHH_ITIMEOUT;
+        uint8_t firstlen = cfg_prefixes[0] ? cfg_prefixes[0] : HHH_FIRSTLEN;
+        uint8_t lastlen = cfg_prefixes[1] ? cfg_prefixes[1] : HHH_LASTLEN;
+        uint64_t now = (pkt.timestamp - start + itimeout) & P4_TIME_MASK;
+        uint32_t addr = pkt.srcPrefix.prefix;
+        uint32_t length = pkt.length;
+
+        // init: indices of all stages and the vector of valid stages
+        uint32_t hashes[HHH_TABCOUNT+1];
+        uint32_t vector = 0;
+        for (unsigned len = 1; len <= HHH_TABCOUNT; len++) {
+            uint32_t key = addr >> (32 - len);
+            uint32_t hash = ((1UL << len) - 1 < tabsize) ? key : tHash::crc32(__bswap_32(key));
+            hashes[len] = (len - 1) * tabsize + hash % tabsize;
+            if (((vld_timestamp_reg[hashes[len]] + itimeout) & P4_TIME_MASK) > now) vector |= 0x80000000U >> (len - 1);
+        }
+
+        // lookup_tab, found(0, 0, 0) by default
+        uint8_t prev_len = 0, curr_len = 0, next_len = 0;
+        for (const tP4Ternary &entry: lookup_tab) {
+            if ((vector & entry.mask) != (entry.value & entry.mask)) continue;
+            prev_len = entry.params[0]; curr_len = entry.params[1]; next_len = entry.params[2];
+            break;
+        }
+
+        // found
+        if (next_len == 0) next_len = firstlen;
+        if (curr_len == firstlen) prev_len = 0;
+        if (curr_len == lastlen) next_len = lastlen;
+        uint32_t prev_idx = index(hashes, prev_len);
+        uint32_t curr_idx = index(hashes, curr_len);
+        uint32_t next_idx = index(hashes, next_len);
+
+        // read_data
+        uint64_t curr_vld_timestamp = vld_timestamp_reg[curr_idx];
+        uint32_t curr_val = cnt_value_reg[curr_idx];
+        uint32_t next_val = cnt_value_reg[next_idx];
+        if (curr_vld_timestamp > cnt_timestamp_reg[curr_idx]) curr_val = 0;
+        if (curr_vld_timestamp > cnt_timestamp_reg[next_idx]) next_val = 0;
+        bool timeout = ((curr_vld_timestamp + atimeout) & P4_TIME_MASK) <= now;
+
+        if (timeout) {
+            // keep
+            if (curr_val >= threshold && curr_len != 0) {
+                digest(curr_val, vector, now, prefix(addr, curr_len), curr_len);
+                report->event(pkt.timestamp, EVENT_HHH, pkt.srcPrefix/curr_len, curr_val);
+                write(curr_idx, length, next_idx, length, now);
+                vld_timestamp_reg[curr_idx] = now;
+
+            // collapse
+            } else {
+                write(curr_idx, length, next_idx, length, now);
+                vld_timestamp_reg[curr_idx] = 0;
+                vld_timestamp_reg[prev_idx] = now;
+            }
+
+        // expand
+        } else if ((uint32_t) (next_val + length) >= threshold && curr_len != lastlen) {
+            digest(curr_val, vector, now, prefix(addr, next_len), next_len);
+            report->event(pkt.timestamp, EVENT_EXPAND, pkt.srcPrefix/next_len, curr_val);
+            write(curr_idx, curr_val - next_val, next_idx, 0, now);
+            vld_timestamp_reg[next_idx] = now;
+
+        // update
+        } else {
+            write(curr_idx, curr_val + length, next_idx, next_val + length, now);
+        }
+
+        return true;
+    }
+
+    // write_data, the next register wins when both are the same
+    inline void write(uint32_t curr_idx, uint32_t curr_val, uint32_t next_idx, uint32_t next_val, uint64_t now) {
+        cnt_value_reg[curr_idx] = curr_val;
+        cnt_value_reg[next_idx] = next_val;
+        cnt_timestamp_reg[curr_idx] = now;
+        cnt_timestamp_reg[next_idx] = now;
+    }
+
+    void digest(uint32_t value, uint32_t vector, uint64_t now, uint32_t prefix, uint8_t length) {
+        digests++;
+        if (!output) return;
+
+        tP4Digest sample;
+        sample.value = __bswap_32(value);
+        sample.vector = __bswap_32(vector);
+        sample.timehi = __bswap_16(now >> 32);
+        sample.timelo = __bswap_32(now);
+        sample.prefix = __bswap_32(prefix);
+        sample.length = length;
+        samples.push_back(sample);
+        if (samples.size() >= P4_DIGEST_SAMPLES) notify();
+    }
+
+    // Writes collected digests as one learning notification
+    void notify() {
+        if (samples.empty()) return;
+
+        tP4DigestHeader header;
+        memcpy(header.topic, "LEA", 4);
+        header.switchid = 0;
+        header.cxtid = 0;
+        header.listid = 1;
+        header.bufferid = bufferid++;
+        header.samples = samples.size();
+        memset(header.padding, 0, sizeof(header.padding));
+        output->write(&header, sizeof(header));
+        output->write(samples.data(), samples.size() * sizeof(tP4Digest));
+        samples.clear();
+    }
+
+    virtual void clear() override {
+    }
+
+    virtual void flush() override {
+        if (output) {
+            notify();
+            output->flush();
+        }
+        report->text() << "digests: " << digests << endl;
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef MODEL_SHARDED_H_
+#define MODEL_SHARDED_H_
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <sstream>
+#include <exception>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include "model.h"
+#include "report.h"
+
+using namespace std;
+
+const size_t SHARD_BATCH = 4096;
+const size_t SHARD_ROUNDS = 4;
+
+// Parallel engine of independent models, packets are dispatched to worker
+// threads by a hash of their prefix of the root length, so subtrees below
+// different roots stay in one model; the results are those of a single
+// model only when it keeps no state shared by the subtrees. Packets go out
+// in rounds of a batch and a ring of rounds keeps the workers busy while the
+// events of the oldest round are merged by timestamp, ties in the order of
+// the workers, and passed to the report. Text of the workers is printed by
+// flush().
+class tModelSharded : public tModel {
+    public:
+        typedef function<tModel *(tReport *)> tFactory;
+
+        tModelSharded(unsigned threads, unsigned firstlen, const tFactory &factory);
+        ~tModelSharded();
+        virtual bool processPacket(tPacket &pkt) override;
+        virtual void clear() override;
+        virtual void flush() override;
+
+    private:
+        struct tShard {
+            ostringstream text;
+            unique_ptr<tReport> report;
+            unique_ptr<tModel> model;
+            bool stopped = false;
+            thread worker;
+        };
+
+        struct tRound {
+            vector<vector<tPacket>> parts;
+            vector<vector<tEventRecord>> events;
+            unsigned pending = 0;
+            bool flush = false;
+            bool clear = false;
+        };
+
+        unsigned _firstlen;
+        vector<unique_ptr<tShard>> _shards;
+        vector<tRound> _rounds;
+        vector<vector<tPacket>> _parts;
+        vector<tEventRecord> _merged;
+        size_t _count = 0;
+        uint64_t _published = 0;
+        uint64_t _collected = 0;
+        bool _stop = false;
+        exception_ptr _error;
+        mutex _mutex;
+        condition_variable _cond;
+
+        inline unsigned _shard(const tPacket &pkt) const;
+        void _publish(bool flush, bool clear = false);
+        void _collect();
+        void _run(unsigned idx);
+};
+
+tModelSharded::tModelSharded(unsigned threads, unsigned firstlen, const tFactory &factory) :
+        _firstlen(max(firstlen, 1U)), _rounds(SHARD_ROUNDS), _parts(max(threads, 1U)) {
+    for (tRound &round: _rounds) {
+        round.parts.resize(_parts.size());
+        round.events.resize(_parts.size());
+    }
+    for (size_t idx = 0; idx < _parts.size(); idx++) {
+        tShard *shard = new tShard();
+        _shards.emplace_back(shard);
+        shard->report.reset(new tReport(shard->text, REPORT_RECORDS));
+        shard->model.reset(factory(shard->report.get()));
+    }
+    for (size_t idx = 0; idx < _shards.size(); idx++)
+        _shards[idx]->worker = thread(&tModelSharded::_run, this, idx);
+}
+
+tModelSharded::~tModelSharded() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+    for (auto &shard: _shards) shard->worker.join();
+}
+
+// Multiplicative hash of the root prefix scaled to the number of workers
+inline unsigned tModelSharded::_shard(const tPacket &pkt) const {
+    uint32_t root = pkt.srcPrefix.prefix >> (32 - _firstlen);
+    return ((uint64_t) (uint32_t) (root * 0x9E3779B1U) * _shards.size()) >> 32;
+}
+
+bool tModelSharded::processPacket(tPacket &pkt) {
+    _parts[_shard(pkt)].push_back(pkt);
+    if (++_count >= SHARD_BATCH) _publish(false);
+    return true;
+}
+
+// Hands the collected packets to the workers as the next round, the oldest
+// round is merged first when the ring is full
+void tModelSharded::_publish(bool flush, bool clear) {
+    if (_published - _collected >= _rounds.size()) _collect();
+
+    tRound &round = _rounds[_published % _rounds.size()];
+    for (size_t idx = 0; idx < _parts.size(); idx++) {
+        round.parts[idx].swap(_parts[idx]);
+        _parts[idx].clear();
+    }
+    _count = 0;
+
+    lock_guard<mutex> lock(_mutex);
+    round.pending = _shards.size();
+    round.flush = flush;
+    round.clear = clear;
+    _published++;
+    _cond.notify_all();
+}
+
+// Waits for the oldest round and reports its events in timestamp order
+void tModelSharded::_collect() {
+    tRound &round = _rounds[_collected % _rounds.size()];
+    {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait(lock, [&round] { return round.pending == 0; });
+        if (_error) rethrow_exception(_error);
+    }
+
+    _merged.clear();
+    for (auto &events: round.events) _merged.insert(_merged.end(), events.begin(), events.end());
+    stable_sort(_merged.begin(), _merged.end(), [](const tEventRecord &a, const tEventRecord &b) {
+        return a.timestamp < b.timestamp;
+    });
+    for (const tEventRecord &record: _merged)
+        report->event(record.timestamp, (tEventType) record.type, record.prefix, record.value);
+    _collected++;
+}
+
+// Worker, runs its part of every round through its model
+void tModelSharded::_run(unsigned idx) {
+    tShard &shard = *_shards[idx];
+    uint64_t seq = 0;
+    unique_lock<mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this, seq] { return _stop || seq < _published; });
+        if (seq >= _published) return;
+
+        tRound &round = _rounds[seq % _rounds.size()];
+        lock.unlock();
+
+        try {
+            for (tPacket &pkt: round.parts[idx]) {
+                if (shard.stopped) break;
+                shard.stopped = !shard.model->processPacket(pkt);
+            }
+            if (round.flush) shard.model->flush();
+            if (round.clear) shard.model->clear();
+        } catch (...) {
+            lock.lock();
+            _error = current_exception();
+            shard.stopped = true;
+            lock.unlock();
+        }
+        shard.report->take(round.events[idx]);
+
+        lock.lock();
+        if (--round.pending == 0) _cond.notify_all();
+        seq++;
+    }
+}
+
+// Clears the models after the packets collected so far
+void tModelSharded::clear() {
+    _publish(false, true);
+}
+
+// Finishes all rounds and flushes the workers, their text follows the events
+void tModelSharded::flush() {
+    _publish(true);
+    while (_collected < _published) _collect();
+
+    ostream &out = report->text();
+    for (size_t idx = 0; idx < _shards.size(); idx++) {
+        out << "shard: " << idx << endl << _shards[idx]->text.str();
+        _shards[idx]->text.str("");
+    }
+}
+
+#endif
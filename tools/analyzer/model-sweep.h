@@ -0,0 +1,191 @@
+#ifndef MODEL_SWEEP_H_
+#define MODEL_SWEEP_H_
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "model.h"
+#include "report.h"
+
+using namespace std;
+
+const size_t SWEEP_BATCH = 4096;
+const size_t SWEEP_ROUNDS = 4;
+
+// Parameter sweep, every configuration runs its own model over all packets
+// and reports into its own file. Packets go out in rounds of a batch which
+// all workers read, each one runs its share of the configurations over it.
+// flush() ends with a summary of the configurations.
+class tModelSweep : public tModel {
+    public:
+        typedef function<tModel *(tReport *)> tFactory;
+
+        tModelSweep(unsigned threads);
+        ~tModelSweep();
+        void add(const string &label, const string &filename, const tFactory &factory);
+        void start();
+        virtual bool processPacket(tPacket &pkt) override;
+        virtual void clear() override;
+        virtual void flush() override;
+
+    private:
+        struct tConfig {
+            string label;
+            string filename;
+            ofstream file;
+            unique_ptr<tReport> report;
+            unique_ptr<tModel> model;
+            bool stopped = false;
+            uint64_t packets = 0;
+            double seconds = 0;
+        };
+
+        struct tRound {
+            vector<tPacket> packets;
+            unsigned pending = 0;
+            bool flush = false;
+        };
+
+        vector<unique_ptr<tConfig>> _configs;
+        vector<thread> _workers;
+        vector<tRound> _rounds;
+        vector<tPacket> _packets;
+        uint64_t _published = 0;
+        uint64_t _collected = 0;
+        bool _stop = false;
+        exception_ptr _error;
+        mutex _mutex;
+        condition_variable _cond;
+
+        void _publish(bool flush);
+        void _collect();
+        void _run(unsigned idx);
+};
+
+tModelSweep::tModelSweep(unsigned threads) : _workers(max(threads, 1U)), _rounds(SWEEP_ROUNDS) {
+}
+
+tModelSweep::~tModelSweep() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+    for (thread &worker: _workers) if (worker.joinable()) worker.join();
+}
+
+// Configuration writing its events and text to the file
+void tModelSweep::add(const string &label, const string &filename, const tFactory &factory) {
+    tConfig *config = new tConfig();
+    _configs.emplace_back(config);
+    config->label = label;
+    config->filename = filename;
+    config->file.open(filename);
+    if (!config->file) throw runtime_error("opening sweep file '" + filename + "' failed");
+    config->report.reset(new tReport(config->file));
+    config->model.reset(factory(config->report.get()));
+}
+
+// Starts the workers once all configurations are added
+void tModelSweep::start() {
+    if (_workers.size() > _configs.size()) _workers.resize(max<size_t>(_configs.size(), 1));
+    for (size_t idx = 0; idx < _workers.size(); idx++)
+        _workers[idx] = thread(&tModelSweep::_run, this, idx);
+}
+
+bool tModelSweep::processPacket(tPacket &pkt) {
+    _packets.push_back(pkt);
+    if (_packets.size() >= SWEEP_BATCH) _publish(false);
+    return true;
+}
+
+// Hands the collected packets to all workers as the next round, waits for
+// the oldest round when the ring is full
+void tModelSweep::_publish(bool flush) {
+    if (_published - _collected >= _rounds.size()) _collect();
+
+    tRound &round = _rounds[_published % _rounds.size()];
+    round.packets.swap(_packets);
+    _packets.clear();
+
+    lock_guard<mutex> lock(_mutex);
+    round.pending = _workers.size();
+    round.flush = flush;
+    _published++;
+    _cond.notify_all();
+}
+
+void tModelSweep::_collect() {
+    tRound &round = _rounds[_collected % _rounds.size()];
+    unique_lock<mutex> lock(_mutex);
+    _cond.wait(lock, [&round] { return round.pending == 0; });
+    if (_error) rethrow_exception(_error);
+    _collected++;
+}
+
+// Worker, runs every round through the configurations idx, idx+workers, ...
+void tModelSweep::_run(unsigned idx) {
+    uint64_t seq = 0;
+    unique_lock<mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this, seq] { return _stop || seq < _published; });
+        if (seq >= _published) return;
+
+        tRound &round = _rounds[seq % _rounds.size()];
+        lock.unlock();
+
+        for (size_t cfg = idx; cfg < _configs.size(); cfg += _workers.size()) {
+            tConfig &config = *_configs[cfg];
+            auto begin = chrono::steady_clock::now();
+            try {
+                tPacket pkt;
+                for (const tPacket &bpkt: round.packets) {
+                    if (config.stopped) break;
+                    pkt = bpkt;
+                    config.packets++;
+                    config.stopped = !config.model->processPacket(pkt);
+                }
+                if (round.flush) {
+                    config.model->flush();
+                    config.report->flush();
+                }
+            } catch (...) {
+                lock.lock();
+                _error = current_exception();
+                config.stopped = true;
+                lock.unlock();
+            }
+            config.seconds += chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        }
+
+        lock.lock();
+        if (--round.pending == 0) _cond.notify_all();
+        seq++;
+    }
+}
+
+void tModelSweep::clear() {
+}
+
+// Finishes all rounds, then prints a line of every configuration
+void tModelSweep::flush() {
+    _publish(true);
+    while (_collected < _published) _collect();
+
+    ostream &out = report->text();
+    out << "sweep: config, packets, events, hhh, seconds, file" << endl;
+    for (auto &config: _configs) {
+        out << "sweep: " << config->label << ", " << config->packets << ", " << config->report->events();
+        out << ", " << config->report->events(EVENT_HHH) << ", " << config->seconds << ", " << config->filename << endl;
+    }
+}
+
+#endif
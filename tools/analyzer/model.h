@@ -3,12 +3,16 @@
 
 #include <string>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
 #include <functional>
 #include <byteswap.h>
 
-#include "utils.h"
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
 
-//#define USECRC32
+#include "utils.h"
 
 using namespace std;
 
@@ -26,11 +30,16 @@ struct __attribute__ ((packed)) tPrefix {
         prefix &= ~0U << (32-length);
     }
 
+    inline char *put(char *out, bool preflen = true) const {
+        out = putIPv4(out, prefix);
+        if (!preflen) return out;
+        *out++ = '/';
+        return putDecimal(out, length);
+    }
+
     inline string str(bool preflen = true) const {
-        const unsigned char *buff = (const unsigned char *) &prefix;
-        if (preflen)
-            return strfrmt("%u.%u.%u.%u/%u", buff[3], buff[2], buff[1], buff[0], length);
-        return strfrmt("%u.%u.%u.%u", buff[3], buff[2], buff[1], buff[0]);
+        char buff[32];
+        return string(buff, put(buff, preflen));
     }
 
     inline bool full() const {
@@ -68,32 +77,79 @@ struct __attribute__ ((packed)) tPacket {
     uint64_t timestamp;
 };
 
+class tReport;
+tReport *defaultReport();
+
 struct tModel {
+    tReport *report = defaultReport();
+
     virtual bool processPacket(tPacket &pkt) = 0;
     virtual void flush() = 0;
     virtual void clear() = 0;
     virtual ~tModel() {};
 };
 
+// Reduction of hashes to a table size, power-of-two sizes are masked and
+// others use a precomputed inverse while the hash fits 32 bits
+struct tHashRange {
+    uint64_t size = 1;
+    uint64_t mask = 0;
+    uint64_t inverse = 0;
+
+    tHashRange(uint64_t size = 1) : size(size) {
+        if ((size & (size - 1)) == 0) mask = size - 1;
+        else if (size >> 32 == 0) inverse = ~0UL / size + 1;
+    }
+
+    inline uint64_t reduce(uint64_t hash) const {
+        __extension__ typedef unsigned __int128 tUint128;
+        if (mask != 0 || size == 1) return hash & mask;
+        if (inverse != 0 && hash >> 32 == 0) return ((tUint128) (inverse * hash) * size) >> 64;
+        return hash % size;
+    }
+
+    // Same as (hash + bit) % size
+    inline uint64_t index(uint64_t hash, bool bit) const {
+        uint64_t index = reduce(hash) + bit;
+        return (index >= size) ? index - size : index;
+    }
+};
+
+enum tHashFamily {
+    HASH_STD,
+    HASH_CRC32,
+    HASH_CRC32C,
+    HASH_MULSHIFT,
+    HASH_TABULATION,
+    HASH_FAMILIES
+};
+
+struct tHashStd;
+
 struct tHash {
     static const uint32_t seed32[32];
+    static const char *names[HASH_FAMILIES];
+
+    // Index of the prefix in a table, short prefixes are mapped directly;
+    // otherwise the family hash plus the last prefix bit modulo the size
+    template<typename F = tHashStd>
     static uint32_t hash32(const tPrefix &pref, unsigned memsize = 1) {
         if (pref.length == 0) return 0;
-        unsigned key = pref.prefix;
         if (1UL << pref.length <= memsize)
-            return (key >> (32-pref.length));
-        key ^= seed32[pref.length-1];
-        #ifdef USECRC32
-            return (crc32(0, (unsigned char *) &key, 4)+pref[pref.length-1]) % memsize;
-        #else
-            return (std::hash<unsigned>{}(key)+pref[pref.length-1]) % memsize;
-        #endif // USECRC32
+            return (pref.prefix >> (32-pref.length));
+        return tHashRange(memsize).index(F::hash(pref.prefix, pref.length), pref[pref.length-1]);
+    }
+
+    static tHashFamily family(const char *name) {
+        for (unsigned f = 0; f < HASH_FAMILIES; f++)
+            if (strcmp(name, names[f]) == 0) return (tHashFamily) f;
+        throw runtime_error(string("unknown hash family '") + name + "'");
     }
 
     // Credits http://create.stephan-brumme.com/crc32/
     // Fast CRC-32 implementation with default polynomial 0xEDB88320
     static const uint32_t crc32lookup[4][256];
-    inline uint32_t crc32(unsigned key) {
+    static inline uint32_t crc32(unsigned key) {
         uint32_t crc = ~0U ^ key;
         crc = crc32lookup[3][crc & 0xFF] ^ crc32lookup[2][(crc >> 8) & 0xFF]
             ^ crc32lookup[1][(crc >> 16) & 0xFF] ^ crc32lookup[0][crc >> 24];
@@ -101,6 +157,10 @@ struct tHash {
     }
 };
 
+const char *tHash::names[HASH_FAMILIES] = {
+    "std", "crc32", "crc32c", "mulshift", "tabulation"
+};
+
 const uint32_t tHash::seed32[32] = {
     0x1123E81F, 0xCC3F21F6, 0x1DE0D01D, 0xC80B077B,
     0xFA56E4DC, 0xA2F6CAAC, 0x2B425BFF, 0x44704806,
@@ -246,4 +306,82 @@ const uint32_t tHash::crc32lookup[4][256] = {  {
     0x43D23E48,0xFB6E592D,0xE9DBF6C3,0x516791A6,0xCCB0A91F,0x740CCE7A,0x66B96194,0xDE0506F1,
 }  };
 
+// Hash families of a prefix given by its bits and length, the length
+// seeds the hash so that levels are independent
+
+// Original family, std::hash of the seeded prefix (identity in libstdc++)
+struct tHashStd {
+    static inline uint64_t hash(unsigned prefix, unsigned len) {
+        return std::hash<unsigned>{}(prefix ^ tHash::seed32[len-1]);
+    }
+};
+
+// CRC-32 of the prefix bits as a big-endian word, the algorithm and input
+// of HashAlgorithm.crc32 in hhh.p4
+struct tHashCrc32 {
+    static inline uint64_t hash(unsigned prefix, unsigned len) {
+        return tHash::crc32(__bswap_32(prefix >> (32-len)));
+    }
+};
+
+// CRC-32C (Castagnoli) of the prefix seeded by its length, by SSE4.2 when
+// compiled with it
+struct tHashCrc32c {
+    static inline uint64_t hash(unsigned prefix, unsigned len) {
+        #ifdef __SSE4_2__
+            return _mm_crc32_u32(tHash::seed32[len-1], prefix);
+        #else
+            static const tTable table;
+            uint32_t crc = tHash::seed32[len-1] ^ prefix;
+            for (unsigned i = 0; i < 4; i++)
+                crc = table.values[crc & 0xFF] ^ (crc >> 8);
+            return crc;
+        #endif // __SSE4_2__
+    }
+
+    struct tTable {
+        uint32_t values[256];
+        tTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (unsigned j = 0; j < 8; j++)
+                    crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+                values[i] = crc;
+            }
+        }
+    };
+};
+
+// Multiply-shift hashing with a random odd multiplier per length
+struct tHashMulShift {
+    static inline uint64_t hash(unsigned prefix, unsigned len) {
+        uint64_t mult = ((uint64_t) tHash::seed32[len-1] << 32 | tHash::seed32[len & 31]) | 1;
+        return (prefix * mult + tHash::seed32[(len+1) & 31]) >> 32;
+    }
+};
+
+// Simple tabulation hashing of the seeded prefix bytes
+struct tHashTabulation {
+    static inline uint64_t hash(unsigned prefix, unsigned len) {
+        static const tTable table;
+        unsigned key = prefix ^ tHash::seed32[len-1];
+        return table.values[0][key & 0xFF] ^ table.values[1][(key >> 8) & 0xFF]
+            ^ table.values[2][(key >> 16) & 0xFF] ^ table.values[3][key >> 24];
+    }
+
+    // Random values by SplitMix64 from a fixed seed
+    struct tTable {
+        uint32_t values[4][256];
+        tTable() {
+            uint64_t state = 0x5EED5EED5EED5EEDUL;
+            for (unsigned i = 0; i < 4; i++) for (unsigned j = 0; j < 256; j++) {
+                uint64_t z = (state += 0x9E3779B97F4A7C15UL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+                values[i][j] = (z ^ (z >> 31)) >> 32;
+            }
+        }
+    };
+};
+
 #endif
@@ -0,0 +1,134 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+const size_t OUTPUT_BUFFER = 4UL << 20;
+const size_t OUTPUT_ALIGN = 4096;
+
+// Buffered file writer, data are collected into large blocks which are
+// written by a single syscall, optionally bypassing the page cache
+class tOutput {
+    public:
+        tOutput(const char *filename, bool direct = false, size_t bufsize = OUTPUT_BUFFER);
+        ~tOutput();
+        inline void write(const void *data, size_t size);
+        inline char *reserve(size_t size);
+        inline void commit(size_t size);
+        void rewrite(uint64_t offset, const void *data, size_t size);
+        void flush();
+        void close();
+        uint64_t tell() const { return _written + _used; }
+
+    private:
+        int _fd = -1;
+        char *_buffer = nullptr;
+        size_t _size = 0;
+        size_t _used = 0;
+        uint64_t _written = 0;
+        bool _direct = false;
+
+        void _write(size_t size);
+        void _buffered();
+};
+
+tOutput::tOutput(const char *filename, bool direct, size_t bufsize) {
+    _size = (bufsize + OUTPUT_ALIGN - 1) & ~(OUTPUT_ALIGN - 1);
+
+    // Filesystems without O_DIRECT support get the ordinary path
+    if (direct) _fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    _direct = _fd >= 0;
+    if (!_direct) _fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) throw runtime_error("Opening file for writing failed!");
+
+    if (posix_memalign((void **) &_buffer, OUTPUT_ALIGN, _size) != 0) {
+        ::close(_fd);
+        throw runtime_error("Allocating output buffer failed!");
+    }
+}
+
+tOutput::~tOutput() {
+    try {
+        close();
+    } catch (...) {
+    }
+    free(_buffer);
+}
+
+// Writes the first size bytes of the buffer and moves the rest to the front
+void tOutput::_write(size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t ret = ::write(_fd, _buffer + done, size - done);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) throw runtime_error("Writing file failed!");
+        done += ret;
+    }
+    memmove(_buffer, _buffer + size, _used - size);
+    _used -= size;
+    _written += size;
+}
+
+// Leaves O_DIRECT mode, the tail of the file is not aligned
+void tOutput::_buffered() {
+    if (!_direct) return;
+    fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+    _direct = false;
+}
+
+inline char *tOutput::reserve(size_t size) {
+    if (_used + size > _size) flush();
+    if (_used + size > _size) throw runtime_error("Output record exceeds buffer size!");
+    return _buffer + _used;
+}
+
+inline void tOutput::commit(size_t size) {
+    _used += size;
+}
+
+inline void tOutput::write(const void *data, size_t size) {
+    while (size > 0) {
+        if (_used == _size) flush();
+        size_t part = min(size, _size - _used);
+        memcpy(_buffer + _used, data, part);
+        _used += part;
+        size -= part;
+        data = (const char *) data + part;
+    }
+}
+
+// Writes out the buffer, in O_DIRECT mode only its aligned part
+void tOutput::flush() {
+    if (_fd < 0 || _used == 0) return;
+    _write(_direct ? _used & ~(OUTPUT_ALIGN - 1) : _used);
+}
+
+// Overwrites already written data, e.g. a header
+void tOutput::rewrite(uint64_t offset, const void *data, size_t size) {
+    _buffered();
+    _write(_used);
+    if (pwrite(_fd, data, size, offset) != (ssize_t) size) throw runtime_error("Writing file failed!");
+}
+
+void tOutput::close() {
+    if (_fd < 0) return;
+    _buffered();
+    int fd = _fd;
+    try {
+        _write(_used);
+    } catch (...) {
+        ::close(fd);
+        _fd = -1;
+        throw;
+    }
+    _fd = -1;
+    if (::close(fd) != 0) throw runtime_error("Writing file failed!");
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PREFIX_TABLE_H_
+#define PREFIX_TABLE_H_
+
+#include <vector>
+#include <cstdint>
+
+#include "model.h"
+
+using namespace std;
+
+const size_t PREFIX_TABLE_SIZE = 1024;
+
+// Flat open-addressing table of prefix nodes keyed by (length, prefix),
+// payloads are stored inline and collisions are resolved by linear probing;
+// erasing shifts the following entries back, so no tombstones are left.
+// Entries are accessed as ->first and ->second like map iterators, pointers
+// to them are invalidated by any insert or erase.
+template<typename T>
+class tPrefixTable {
+    public:
+        struct tEntry {
+            tPrefix first;
+            T second;
+        };
+
+        class iterator {
+            public:
+                iterator(tEntry *entry, tEntry *last) : _entry(entry), _last(last) { _skip(); }
+                tEntry &operator*() const { return *_entry; }
+                tEntry *operator->() const { return _entry; }
+                iterator &operator++() { _entry++; _skip(); return *this; }
+                iterator operator++(int) { iterator it = *this; ++*this; return it; }
+                bool operator!=(const iterator &rhs) const { return _entry != rhs._entry; }
+                bool operator==(const iterator &rhs) const { return _entry == rhs._entry; }
+
+            private:
+                tEntry *_entry;
+                tEntry *_last;
+
+                void _skip() { while (_entry != _last && _entry->first.length == EMPTY) _entry++; }
+        };
+
+        tPrefixTable(size_t size = PREFIX_TABLE_SIZE);
+        inline tEntry *find(const tPrefix &pref);
+        inline tEntry *insert(const tPrefix &pref);
+        inline void erase(tEntry *entry);
+        inline T &operator[](const tPrefix &pref) { return insert(pref)->second; }
+        iterator begin() { return iterator(_slots.data(), _slots.data() + _slots.size()); }
+        iterator end() { return iterator(_slots.data() + _slots.size(), _slots.data() + _slots.size()); }
+        size_t size() const { return _count; }
+        void clear();
+
+    private:
+        static const unsigned EMPTY = ~0U;
+
+        vector<tEntry> _slots;
+        size_t _mask;
+        unsigned _shift;
+        size_t _count = 0;
+
+        inline size_t _home(const tPrefix &pref) const;
+        void _grow();
+};
+
+template<typename T>
+tPrefixTable<T>::tPrefixTable(size_t size) {
+    size_t slots = 2;
+    while (slots < size) slots <<= 1;
+    _slots.resize(slots);
+    for (tEntry &entry: _slots) entry.first.length = EMPTY;
+    _mask = slots - 1;
+    _shift = 64 - __builtin_ctzl(slots);
+}
+
+// Fibonacci hashing of both the length and the prefix
+template<typename T>
+inline size_t tPrefixTable<T>::_home(const tPrefix &pref) const {
+    uint64_t key = ((uint64_t) pref.length << 32) | pref.prefix;
+    return (key * 0x9E3779B97F4A7C15UL) >> _shift;
+}
+
+template<typename T>
+inline typename tPrefixTable<T>::tEntry *tPrefixTable<T>::find(const tPrefix &pref) {
+    for (size_t idx = _home(pref); ; idx = (idx + 1) & _mask) {
+        tEntry &entry = _slots[idx];
+        if (entry.first.length == EMPTY) return nullptr;
+        if (entry.first == pref) return &entry;
+    }
+}
+
+// Returns the entry of the prefix, a new one with a default payload if missing
+template<typename T>
+inline typename tPrefixTable<T>::tEntry *tPrefixTable<T>::insert(const tPrefix &pref) {
+    if ((_count + 1) * 2 > _slots.size()) _grow();
+
+    for (size_t idx = _home(pref); ; idx = (idx + 1) & _mask) {
+        tEntry &entry = _slots[idx];
+        if (entry.first == pref) return &entry;
+        if (entry.first.length != EMPTY) continue;
+        entry.first = pref;
+        entry.second = T();
+        _count++;
+        return &entry;
+    }
+}
+
+// Backward shift deletion, entries of the following cluster which may
+// live in the hole move into it
+template<typename T>
+inline void tPrefixTable<T>::erase(tEntry *entry) {
+    size_t hole = entry - _slots.data();
+    for (size_t idx = (hole + 1) & _mask; _slots[idx].first.length != EMPTY; idx = (idx + 1) & _mask) {
+        size_t home = _home(_slots[idx].first);
+        if (((idx - home) & _mask) < ((idx - hole) & _mask)) continue;
+        _slots[hole] = _slots[idx];
+        hole = idx;
+    }
+    _slots[hole].first.length = EMPTY;
+    _count--;
+}
+
+template<typename T>
+void tPrefixTable<T>::clear() {
+    for (tEntry &entry: _slots) entry.first.length = EMPTY;
+    _count = 0;
+}
+
+template<typename T>
+void tPrefixTable<T>::_grow() {
+    vector<tEntry> slots(_slots.size() * 2);
+    for (tEntry &entry: slots) entry.first.length = EMPTY;
+    slots.swap(_slots);
+    _mask = _slots.size() - 1;
+    _shift--;
+
+    for (tEntry &entry: slots) {
+        if (entry.first.length == EMPTY) continue;
+        size_t idx = _home(entry.first);
+        while (_slots[idx].first.length != EMPTY) idx = (idx + 1) & _mask;
+        _slots[idx] = entry;
+    }
+}
+
+#endif
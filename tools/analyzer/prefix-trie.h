@@ -0,0 +1,191 @@
+#ifndef PREFIX_TRIE_H_
+#define PREFIX_TRIE_H_
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "model.h"
+#include "prefix-table.h"
+
+using namespace std;
+
+// Levels of the trie in the DIR-16-8-8 style, by first bit of the level
+constexpr unsigned TRIE_BOUNDS[] = {0, 16, 24, 32};
+constexpr unsigned TRIE_LEVELS = 3;
+
+// Prefix nodes kept in a tPrefixTable with an optional multibit trie index;
+// every slot of the index holds the longest stored prefix covering it within
+// the level (expanded over the slot range) and the chunk of the next level.
+// The longest prefix of an address is found in at most three slot reads
+// and one table probe.
+template<typename T>
+class tPrefixTrie {
+    public:
+        typedef typename tPrefixTable<T>::tEntry tEntry;
+        typedef typename tPrefixTable<T>::iterator iterator;
+
+        void init(bool indexed);
+        inline tEntry *find(const tPrefix &pref) { return _table.find(pref); }
+        inline tEntry *insert(const tPrefix &pref);
+        inline void erase(tEntry *entry);
+        inline tEntry *lookup(const tPrefix &addr);
+        inline T &operator[](const tPrefix &pref) { return insert(pref)->second; }
+        iterator begin() { return _table.begin(); }
+        iterator end() { return _table.end(); }
+        size_t size() const { return _table.size(); }
+        void clear();
+
+    private:
+        struct tSlot {
+            uint32_t child = 0;
+            uint8_t best = 0;
+        };
+
+        static const unsigned ROOT_SIZE = 1U << (TRIE_BOUNDS[1] - TRIE_BOUNDS[0]);
+        static const unsigned CHUNK_SIZE = 1U << (TRIE_BOUNDS[2] - TRIE_BOUNDS[1]);
+
+        tPrefixTable<T> _table;
+        bool _indexed = false;
+
+        // Root level first, chunks of the next levels follow; a child is
+        // the offset of its chunk, chunk counts hold stored prefixes and
+        // child chunks
+        vector<tSlot> _slots;
+        vector<unsigned> _counts;
+        vector<uint32_t> _free;
+
+        static inline unsigned _level(unsigned len);
+        static inline unsigned _index(unsigned addr, unsigned level);
+        inline unsigned &_count(uint32_t base) { return _counts[(base - ROOT_SIZE) / CHUNK_SIZE]; }
+        uint32_t _alloc();
+        void _add(const tPrefix &pref);
+        void _remove(const tPrefix &pref);
+};
+
+template<typename T>
+void tPrefixTrie<T>::init(bool indexed) {
+    _indexed = indexed;
+    clear();
+}
+
+template<typename T>
+void tPrefixTrie<T>::clear() {
+    _table.clear();
+    _slots.assign(_indexed ? ROOT_SIZE : 0, tSlot());
+    _counts.clear();
+    _free.clear();
+}
+
+template<typename T>
+inline unsigned tPrefixTrie<T>::_level(unsigned len) {
+    unsigned level = 0;
+    while (len > TRIE_BOUNDS[level+1]) level++;
+    return level;
+}
+
+template<typename T>
+inline unsigned tPrefixTrie<T>::_index(unsigned addr, unsigned level) {
+    return (addr << TRIE_BOUNDS[level]) >> (32 - (TRIE_BOUNDS[level+1] - TRIE_BOUNDS[level]));
+}
+
+template<typename T>
+inline typename tPrefixTrie<T>::tEntry *tPrefixTrie<T>::insert(const tPrefix &pref) {
+    size_t count = _table.size();
+    tEntry *entry = _table.insert(pref);
+    if (!_indexed || _table.size() == count) return entry;
+    _add(pref);
+    return entry;
+}
+
+template<typename T>
+inline void tPrefixTrie<T>::erase(tEntry *entry) {
+    tPrefix pref = entry->first;
+    _table.erase(entry);
+    if (_indexed) _remove(pref);
+}
+
+// Longest stored prefix of the address, only with the index
+template<typename T>
+inline typename tPrefixTrie<T>::tEntry *tPrefixTrie<T>::lookup(const tPrefix &addr) {
+    unsigned best = 0;
+    uint32_t base = 0;
+    for (unsigned level = 0; level < TRIE_LEVELS; level++) {
+        const tSlot &slot = _slots[base + _index(addr.prefix, level)];
+        if (slot.best != 0) best = slot.best;
+        if ((base = slot.child) == 0) break;
+    }
+    if (best == 0) return nullptr;
+    return _table.find(addr/(best-1));
+}
+
+template<typename T>
+uint32_t tPrefixTrie<T>::_alloc() {
+    uint32_t base;
+    if (_free.empty()) {
+        base = _slots.size();
+        _slots.resize(base + CHUNK_SIZE);
+        _counts.push_back(0);
+    } else {
+        base = _free.back();
+        _free.pop_back();
+        fill(_slots.begin() + base, _slots.begin() + base + CHUNK_SIZE, tSlot());
+    }
+    return base;
+}
+
+// Marks the prefix in its level, chunks on the way are created when missing
+template<typename T>
+void tPrefixTrie<T>::_add(const tPrefix &pref) {
+    unsigned level = _level(pref.length);
+
+    uint32_t base = 0;
+    for (unsigned l = 0; l < level; l++) {
+        unsigned idx = _index(pref.prefix, l);
+        if (_slots[base + idx].child == 0) {
+            uint32_t child = _alloc();
+            _slots[base + idx].child = child;
+            if (base != 0) _count(base)++;
+        }
+        base = _slots[base + idx].child;
+    }
+
+    unsigned first = base + _index(pref.prefix, level);
+    unsigned span = 1U << (TRIE_BOUNDS[level+1] - pref.length);
+    for (unsigned idx = first; idx < first + span; idx++)
+        if (_slots[idx].best < pref.length + 1) _slots[idx].best = pref.length + 1;
+    if (base != 0) _count(base)++;
+}
+
+// Unmarks the prefix, its slots fall back to the next shorter prefix of the
+// level and chunks left empty are released
+template<typename T>
+void tPrefixTrie<T>::_remove(const tPrefix &pref) {
+    unsigned level = _level(pref.length);
+
+    uint32_t path[TRIE_LEVELS];
+    uint32_t base = 0;
+    for (unsigned l = 0; l < level; l++) {
+        path[l] = base + _index(pref.prefix, l);
+        base = _slots[path[l]].child;
+    }
+
+    uint8_t repl = 0;
+    unsigned lower = (level == 0) ? 0 : TRIE_BOUNDS[level] + 1;
+    for (unsigned len = pref.length; len-- > lower; ) {
+        if (_table.find(pref/len) != nullptr) { repl = len + 1; break; }
+    }
+
+    unsigned first = base + _index(pref.prefix, level);
+    unsigned span = 1U << (TRIE_BOUNDS[level+1] - pref.length);
+    for (unsigned idx = first; idx < first + span; idx++)
+        if (_slots[idx].best == pref.length + 1) _slots[idx].best = repl;
+
+    while (base != 0 && --_count(base) == 0) {
+        _free.push_back(base);
+        _slots[path[--level]].child = 0;
+        base = path[level] - _index(pref.prefix, level);
+    }
+}
+
+#endif
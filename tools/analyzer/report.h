@@ -0,0 +1,244 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+
+#include "model.h"
+#include "output.h"
+
+using namespace std;
+
+const size_t REPORT_BUFFER = 1UL << 20;
+const size_t REPORT_LINE = 192;
+
+enum tReportMode {
+    REPORT_TEXT,    // Buffered text lines
+    REPORT_BINARY,  // Binary event records in a separate file
+    REPORT_ASYNC,   // Text lines written by a background thread
+    REPORT_RECORDS  // Event records kept in memory until taken
+};
+
+enum tEventType : uint32_t {
+    EVENT_INVALID,
+    EVENT_HHH,
+    EVENT_MOVE,
+    EVENT_COLLAPSE,
+    EVENT_EXPAND,
+    EVENT_WINDOW_HHH, // Offline hierarchical heavy-hitter
+    EVENT_WINDOW_HH,  // Offline pure heavy-hitter
+    EVENT_COUNTER     // Offline counter report
+};
+
+struct __attribute__ ((packed)) tEventRecord {
+    uint64_t timestamp;
+    uint64_t value;
+    tPrefix prefix;
+    uint32_t type;
+    uint32_t reserved;
+};
+
+// Sink of model events, events are formatted into a buffer which is written
+// out in large blocks; other text goes through text() to keep the order
+class tReport {
+    public:
+        tReport(ostream &out = cout, tReportMode mode = REPORT_TEXT, const char *filename = nullptr);
+        ~tReport();
+        inline void event(uint64_t timestamp, tEventType type, const tPrefix &prefix, uint64_t value);
+        ostream &text();
+        void flush();
+        inline void take(vector<tEventRecord> &records);
+        bool pin(int cpu);
+        uint64_t stalls() const { return _stalls; }
+        uint64_t events() const;
+        uint64_t events(tEventType type) const { return _events[type]; }
+
+    private:
+        ostream &_out;
+        unique_ptr<tOutput> _binary;
+        vector<char> _buffer;
+        size_t _used = 0;
+        uint64_t _events[EVENT_COUNTER+1] = {};
+        bool _recording = false;
+        vector<tEventRecord> _records;
+
+        // Background writer state
+        bool _async = false;
+        bool _busy = false;
+        bool _stop = false;
+        vector<char> _pending;
+        size_t _pendused = 0;
+        uint64_t _stalls = 0;
+        mutex _mutex;
+        condition_variable _cond;
+        thread _thread;
+
+        void _run();
+        void _submit();
+        void _write(const char *data, size_t size);
+};
+
+tReport::tReport(ostream &out, tReportMode mode, const char *filename) : _out(out), _buffer(REPORT_BUFFER) {
+    if (mode == REPORT_BINARY) {
+        if (filename == nullptr) throw runtime_error("Missing file for binary events!");
+        _binary.reset(new tOutput(filename));
+    }
+    _recording = mode == REPORT_RECORDS;
+    if ((_async = mode == REPORT_ASYNC)) {
+        _pending.resize(REPORT_BUFFER);
+        _thread = thread(&tReport::_run, this);
+    }
+}
+
+tReport::~tReport() {
+    flush();
+    if (_async) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        _thread.join();
+    }
+}
+
+template<size_t N>
+inline char *putString(char *out, const char (&text)[N]) {
+    memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+inline void tReport::event(uint64_t timestamp, tEventType type, const tPrefix &prefix, uint64_t value) {
+    _events[type]++;
+    if (_recording) {
+        tEventRecord record;
+        record.timestamp = timestamp;
+        record.value = value;
+        record.prefix = prefix;
+        record.type = type;
+        record.reserved = 0;
+        _records.push_back(record);
+        return;
+    }
+    if (_used + REPORT_LINE > _buffer.size()) _submit();
+
+    if (_binary) {
+        tEventRecord record;
+        record.timestamp = timestamp;
+        record.value = value;
+        record.prefix = prefix;
+        record.type = type;
+        record.reserved = 0;
+        memcpy(_buffer.data() + _used, &record, sizeof(record));
+        _used += sizeof(record);
+        return;
+    }
+
+    char *line = _buffer.data() + _used, *out = line;
+    switch (type) {
+        case EVENT_WINDOW_HHH:
+        case EVENT_WINDOW_HH:
+            out = putDecimal(putString(out, "timestamp: "), timestamp);
+            out = (type == EVENT_WINDOW_HHH) ? putString(out, ", hhh: 1, prefix: ") : putString(out, ", hhh: 0, prefix: ");
+            out = putDecimal(putString(prefix.put(out), ", value: "), value);
+            break;
+        case EVENT_COUNTER:
+            out = putDecimal(putString(out, "timestamp,"), timestamp);
+            out = putDecimal(putString(prefix.put(putString(out, ",report,prefix,")), ",value,"), value);
+            break;
+        default: {
+            static const char *names[] = {"invalid", "hhh", "move", "collapse", "expand"};
+            out = putDecimal(putString(out, "timestamp: "), timestamp);
+            out = stpcpy(putString(out, ", event: "), names[type]);
+            out = putDecimal(putString(prefix.put(putString(out, ", prefix_found: ")), ", value: "), value);
+            break;
+        }
+    }
+    *out++ = '\n';
+    _used += out - line;
+}
+
+void tReport::_write(const char *data, size_t size) {
+    if (_binary) _binary->write(data, size);
+    else _out.write(data, size);
+}
+
+// Hands the buffer over to the writer, or writes it out directly
+void tReport::_submit() {
+    if (_used == 0) return;
+    if (!_async) {
+        _write(_buffer.data(), _used);
+        _used = 0;
+        return;
+    }
+
+    unique_lock<mutex> lock(_mutex);
+    if (_busy) _stalls++;
+    _cond.wait(lock, [this] { return !_busy; });
+    _buffer.swap(_pending);
+    _pendused = _used;
+    _used = 0;
+    _busy = true;
+    _cond.notify_all();
+}
+
+void tReport::_run() {
+    unique_lock<mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this] { return _stop || _busy; });
+        if (!_busy) return;
+
+        lock.unlock();
+        _write(_pending.data(), _pendused);
+        lock.lock();
+        _busy = false;
+        _cond.notify_all();
+    }
+}
+
+// Restricts the background writer to the core
+bool tReport::pin(int cpu) {
+    return _async && pinThread(_thread.native_handle(), cpu);
+}
+
+// Number of events of all types reported so far
+uint64_t tReport::events() const {
+    uint64_t count = 0;
+    for (uint64_t events: _events) count += events;
+    return count;
+}
+
+// Moves out the records collected so far
+inline void tReport::take(vector<tEventRecord> &records) {
+    records.clear();
+    _records.swap(records);
+}
+
+// Stream for other text output, events reported so far are written first
+ostream &tReport::text() {
+    _submit();
+    if (_async) {
+        unique_lock<mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return !_busy; });
+    }
+    return _out;
+}
+
+// Writes out all events reported so far
+void tReport::flush() {
+    text().flush();
+    if (_binary) _binary->flush();
+}
+
+// Sink used by models which were not given another one
+tReport *defaultReport() {
+    static tReport report;
+    return &report;
+}
+
+#endif
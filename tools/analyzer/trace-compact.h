@@ -0,0 +1,402 @@
+#ifndef TRACE_COMPACT_H_
+#define TRACE_COMPACT_H_
+
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "trace-index.h"
+
+using namespace std;
+
+// PDAT v2: self-describing columnar format, organised into fixed-size blocks
+//
+//   file   := header block*
+//   block  := block header, columns (sizes in the block header)
+//
+// Timestamps are zigzag varint deltas, lengths are varints and addresses
+// are stored as a sorted per-block dictionary (varint deltas) referenced
+// by varint indices. Constant IPv4 /32 fields are omitted (BLOCK_UNIFORM).
+// The block directory (tIndexEntry per block) is stored at indexoffset.
+
+const char COMPACT_MAGIC[4] = {'P', 'D', 'A', 'T'};
+const uint16_t COMPACT_VERSION = 2;
+const uint32_t COMPACT_BLOCK = 16384;
+
+enum tCompactColumn {
+    COL_TIME, COL_LENGTH,
+    COL_SRCDICT, COL_SRCIDX,
+    COL_DSTDICT, COL_DSTIDX,
+    COL_IPVER, COL_SRCLEN, COL_DSTLEN,
+    COL_COUNT
+};
+
+const uint32_t BLOCK_UNIFORM = 0x1;
+
+struct __attribute__ ((packed)) tCompactHeader {
+    char magic[4];
+    uint16_t version = COMPACT_VERSION;
+    uint16_t hdrsize = sizeof(tCompactHeader);
+    uint32_t blockpackets = COMPACT_BLOCK;
+    uint32_t flags = 0;
+    uint64_t packets = 0;
+    uint64_t blocks = 0;
+    uint64_t firsttime = 0;
+    uint64_t lasttime = 0;
+    uint64_t indexoffset = 0;
+};
+
+struct __attribute__ ((packed)) tCompactBlock {
+    uint32_t count = 0;
+    uint32_t flags = 0;
+    uint64_t basetime = 0;
+    uint64_t mintime = 0;
+    uint64_t maxtime = 0;
+    uint32_t colsize[COL_COUNT] = {0};
+};
+
+inline void putVarint(vector<unsigned char> &buff, uint64_t value) {
+    while (value >= 0x80) {
+        buff.push_back((unsigned char) value | 0x80);
+        value >>= 7;
+    }
+    buff.push_back((unsigned char) value);
+}
+
+inline uint64_t getVarint(const unsigned char *&data, const unsigned char *end) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (data >= end) throw runtime_error("Corrupted PDAT v2 block!");
+        unsigned char byte = *data++;
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    throw runtime_error("Corrupted PDAT v2 block!");
+}
+
+inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Reader and writer of PDAT v2 files
+class tTraceCompact : public tTrace {
+    public:
+        tTraceCompact(const char *filename, bool write = false, bool direct = false);
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        bool savePacket(const tPacket &pkt);
+        void finish();
+        static bool probe(const char *filename);
+        ~tTraceCompact();
+
+    private:
+        tCompactHeader _header;
+        tTraceIndex _index;
+        bool _write = false;
+
+        // Reader state
+        int _fd = -1;
+        const unsigned char *_data = nullptr;
+        size_t _size = 0;
+        size_t _offset = 0;
+        size_t _end = 0;
+        size_t _position = 0;
+        size_t _count = 0;
+
+        // Writer state
+        unique_ptr<tOutput> _output;
+        vector<tPacket> _pending;
+        vector<unsigned char> _columns[COL_COUNT];
+        vector<unsigned> _dict;
+
+        void _encodeBlock();
+        void _encodeDict(tCompactColumn dcol, tCompactColumn icol, bool src);
+        bool _decodeBlock();
+        void _loadIndex();
+};
+
+tTraceCompact::tTraceCompact(const char *filename, bool write, bool direct) {
+    memcpy(_header.magic, COMPACT_MAGIC, sizeof(_header.magic));
+
+    if ((_write = write)) {
+        _output.reset(new tOutput(filename, direct));
+        _output->write(&_header, sizeof(_header));
+        _pending.reserve(_header.blockpackets);
+        return;
+    }
+
+    _fd = open(filename, O_RDONLY);
+    if (_fd < 0) throw runtime_error("Opening file for reading failed!");
+
+    struct stat st;
+    if (fstat(_fd, &st) < 0 || (size_t) st.st_size < sizeof(tCompactHeader)) {
+        close(_fd);
+        throw runtime_error("Reading PDAT v2 header failed!");
+    }
+
+    _size = st.st_size;
+    void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (data == MAP_FAILED) {
+        close(_fd);
+        throw runtime_error("Mapping file into memory failed!");
+    }
+    _data = (const unsigned char *) data;
+    madvise(data, _size, MADV_SEQUENTIAL);
+
+    memcpy(&_header, _data, sizeof(_header));
+    if (memcmp(_header.magic, COMPACT_MAGIC, sizeof(_header.magic)) != 0 || _header.version != COMPACT_VERSION) {
+        munmap(data, _size);
+        close(_fd);
+        throw runtime_error("Unsupported PDAT version!");
+    }
+    if (_header.hdrsize < sizeof(_header))
+        memset((char *) &_header + _header.hdrsize, 0, sizeof(_header) - _header.hdrsize);
+    _offset = _header.hdrsize;
+    _end = (_header.indexoffset && _header.indexoffset < _size) ? _header.indexoffset : _size;
+}
+
+tTraceCompact::~tTraceCompact() {
+    if (_write) {
+        // Errors can not be reported from here, writers call finish() first
+        try {
+            finish();
+        } catch (...) {
+        }
+    } else {
+        if (_data) munmap((void *) _data, _size);
+        if (_fd >= 0) close(_fd);
+    }
+}
+
+// Checks whether the file starts with the PDAT v2 header
+bool tTraceCompact::probe(const char *filename) {
+    char magic[sizeof(COMPACT_MAGIC)];
+    ifstream file(filename, ifstream::binary);
+    if (!file.read(magic, sizeof(magic))) return false;
+    return memcmp(magic, COMPACT_MAGIC, sizeof(magic)) == 0;
+}
+
+bool tTraceCompact::savePacket(const tPacket &pkt) {
+    if (_header.packets == 0) _header.firsttime = pkt.timestamp;
+    _header.lasttime = pkt.timestamp;
+    _header.packets++;
+
+    _pending.push_back(pkt);
+    if (_pending.size() >= _header.blockpackets) _encodeBlock();
+    return true;
+}
+
+// Writes the last block, the block directory and the final header; the
+// file is closed even when this fails, so it is not finished twice
+void tTraceCompact::finish() {
+    if (!_output) return;
+    try {
+        if (!_pending.empty()) _encodeBlock();
+        _header.indexoffset = _output->tell();
+        _output->write(_index.entries.data(), _index.entries.size() * sizeof(tIndexEntry));
+        _output->rewrite(0, &_header, sizeof(_header));
+        _output->close();
+    } catch (...) {
+        _output.reset();
+        throw;
+    }
+    _output.reset();
+}
+
+// Stores the column of source or destination addresses as a dictionary
+void tTraceCompact::_encodeDict(tCompactColumn dcol, tCompactColumn icol, bool src) {
+    _dict.clear();
+    for (const tPacket &pkt: _pending)
+        _dict.push_back(src ? pkt.srcPrefix.prefix : pkt.dstPrefix.prefix);
+    sort(_dict.begin(), _dict.end());
+    _dict.erase(unique(_dict.begin(), _dict.end()), _dict.end());
+
+    putVarint(_columns[dcol], _dict.size());
+    unsigned last = 0;
+    for (unsigned addr: _dict) {
+        putVarint(_columns[dcol], addr - last);
+        last = addr;
+    }
+
+    for (const tPacket &pkt: _pending) {
+        unsigned addr = src ? pkt.srcPrefix.prefix : pkt.dstPrefix.prefix;
+        putVarint(_columns[icol], lower_bound(_dict.begin(), _dict.end(), addr) - _dict.begin());
+    }
+}
+
+void tTraceCompact::_encodeBlock() {
+    tCompactBlock block;
+    block.count = _pending.size();
+    block.basetime = _pending.front().timestamp;
+    block.mintime = block.maxtime = block.basetime;
+    block.flags = BLOCK_UNIFORM;
+
+    for (unsigned c = 0; c < COL_COUNT; c++) _columns[c].clear();
+
+    uint64_t last = block.basetime;
+    for (const tPacket &pkt: _pending) {
+        putVarint(_columns[COL_TIME], zigzag(pkt.timestamp - last));
+        putVarint(_columns[COL_LENGTH], pkt.length);
+        block.mintime = min(block.mintime, pkt.timestamp);
+        block.maxtime = max(block.maxtime, pkt.timestamp);
+        last = pkt.timestamp;
+
+        if (pkt.ipver != 4 || pkt.srcPrefix.length != 32 || pkt.dstPrefix.length != 32)
+            block.flags &= ~BLOCK_UNIFORM;
+    }
+
+    _encodeDict(COL_SRCDICT, COL_SRCIDX, true);
+    _encodeDict(COL_DSTDICT, COL_DSTIDX, false);
+
+    if (!(block.flags & BLOCK_UNIFORM)) {
+        for (const tPacket &pkt: _pending) {
+            putVarint(_columns[COL_IPVER], pkt.ipver);
+            putVarint(_columns[COL_SRCLEN], pkt.srcPrefix.length);
+            putVarint(_columns[COL_DSTLEN], pkt.dstPrefix.length);
+        }
+    }
+
+    for (unsigned c = 0; c < COL_COUNT; c++) block.colsize[c] = _columns[c].size();
+
+    _index.entries.push_back(tIndexEntry());
+    _index.entries.back().offset = _output->tell();
+    _index.entries.back().mintime = block.mintime;
+    _index.entries.back().maxtime = block.maxtime;
+
+    _output->write(&block, sizeof(block));
+    for (unsigned c = 0; c < COL_COUNT; c++)
+        _output->write(_columns[c].data(), _columns[c].size());
+
+    _header.blocks++;
+    _pending.clear();
+}
+
+// Decodes the next block into the batch buffer
+bool tTraceCompact::_decodeBlock() {
+    if (_offset + sizeof(tCompactBlock) > _end) return false;
+
+    tCompactBlock block;
+    memcpy(&block, _data + _offset, sizeof(block));
+    _offset += sizeof(block);
+
+    const unsigned char *cols[COL_COUNT], *ends[COL_COUNT];
+    for (unsigned c = 0; c < COL_COUNT; c++) {
+        if (_offset + block.colsize[c] > _end) throw runtime_error("Corrupted PDAT v2 block!");
+        cols[c] = _data + _offset;
+        ends[c] = cols[c] + block.colsize[c];
+        _offset += block.colsize[c];
+    }
+
+    vector<unsigned> srcdict(getVarint(cols[COL_SRCDICT], ends[COL_SRCDICT]));
+    for (unsigned i = 0, last = 0; i < srcdict.size(); i++)
+        srcdict[i] = last += getVarint(cols[COL_SRCDICT], ends[COL_SRCDICT]);
+
+    vector<unsigned> dstdict(getVarint(cols[COL_DSTDICT], ends[COL_DSTDICT]));
+    for (unsigned i = 0, last = 0; i < dstdict.size(); i++)
+        dstdict[i] = last += getVarint(cols[COL_DSTDICT], ends[COL_DSTDICT]);
+
+    bool uniform = block.flags & BLOCK_UNIFORM;
+    _batch.resize(block.count);
+
+    uint64_t timestamp = block.basetime;
+    for (tPacket &pkt: _batch) {
+        timestamp += unzigzag(getVarint(cols[COL_TIME], ends[COL_TIME]));
+        pkt.timestamp = timestamp;
+        pkt.length = getVarint(cols[COL_LENGTH], ends[COL_LENGTH]);
+
+        uint64_t srcidx = getVarint(cols[COL_SRCIDX], ends[COL_SRCIDX]);
+        uint64_t dstidx = getVarint(cols[COL_DSTIDX], ends[COL_DSTIDX]);
+        if (srcidx >= srcdict.size() || dstidx >= dstdict.size())
+            throw runtime_error("Corrupted PDAT v2 block!");
+        pkt.srcPrefix.prefix = srcdict[srcidx];
+        pkt.dstPrefix.prefix = dstdict[dstidx];
+
+        if (uniform) {
+            pkt.ipver = 4;
+            pkt.srcPrefix.length = 32;
+            pkt.dstPrefix.length = 32;
+        } else {
+            pkt.ipver = getVarint(cols[COL_IPVER], ends[COL_IPVER]);
+            pkt.srcPrefix.length = getVarint(cols[COL_SRCLEN], ends[COL_SRCLEN]);
+            pkt.dstPrefix.length = getVarint(cols[COL_DSTLEN], ends[COL_DSTLEN]);
+        }
+    }
+
+    _position = 0;
+    _count = block.count;
+    return true;
+}
+
+// Reads the block directory, or walks the block headers of files without it
+void tTraceCompact::_loadIndex() {
+    size_t blocks = _header.blocks;
+    if (_header.indexoffset && _header.indexoffset <= _size && blocks <= (_size - _header.indexoffset) / sizeof(tIndexEntry)) {
+        _index.entries.resize(blocks);
+        memcpy(_index.entries.data(), _data + _header.indexoffset, blocks * sizeof(tIndexEntry));
+        if (_index.valid(_end)) return;
+        _index.entries.clear();
+    }
+
+    tCompactBlock block;
+    for (size_t offset = _header.hdrsize; offset + sizeof(block) <= _size; ) {
+        memcpy(&block, _data + offset, sizeof(block));
+        _index.entries.push_back(tIndexEntry());
+        _index.entries.back().offset = offset;
+        _index.entries.back().mintime = block.mintime;
+        _index.entries.back().maxtime = block.maxtime;
+        offset += sizeof(block);
+        for (unsigned c = 0; c < COL_COUNT; c++) offset += block.colsize[c];
+    }
+}
+
+bool tTraceCompact::seek(uint64_t tbegin, uint64_t tend) {
+    if (_index.entries.empty()) _loadIndex();
+
+    size_t first, last;
+    if (!_index.window(tbegin, tend, first, last)) {
+        _end = _offset;
+        _position = _count;
+        return true;
+    }
+
+    if (last < _index.entries.size())
+        _end = min<size_t>(_end, _index.entries[last].offset);
+    if (_index.entries[first].offset <= _offset) return false;
+
+    _offset = _index.entries[first].offset;
+    _position = _count;
+    return true;
+}
+
+bool tTraceCompact::nextPacket(tPacket &pkt) {
+    while (_position >= _count) {
+        if (!_decodeBlock()) return false;
+    }
+    pkt = _batch[_position++];
+    return true;
+}
+
+bool tTraceCompact::nextBatch(tBatch &batch) {
+    while (_position >= _count) {
+        if (!_decodeBlock()) return false;
+    }
+    batch.packets = _batch.data() + _position;
+    batch.count = _count - _position;
+    _position = _count;
+    return true;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef TRACE_INDEX_H_
+#define TRACE_INDEX_H_
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+// Sparse time index of a trace, each entry covers a chunk of packets
+// (or a single PDAT v2 block) and keeps the time range of the chunk, so
+// the index stays exact even for slightly unordered traces.
+
+const char INDEX_MAGIC[4] = {'T', 'I', 'D', 'X'};
+const uint16_t INDEX_VERSION = 1;
+const uint32_t INDEX_STRIDE = 65536;
+const char INDEX_SUFFIX[] = ".tidx";
+
+struct __attribute__ ((packed)) tIndexEntry {
+    uint64_t offset = 0;
+    uint64_t mintime = 0;
+    uint64_t maxtime = 0;
+};
+
+struct __attribute__ ((packed)) tIndexHeader {
+    char magic[4];
+    uint16_t version = INDEX_VERSION;
+    uint16_t hdrsize = sizeof(tIndexHeader);
+    uint32_t stride = INDEX_STRIDE;
+    uint64_t datasize = 0;
+    uint64_t entries = 0;
+};
+
+struct tTraceIndex {
+    uint32_t stride = INDEX_STRIDE;
+    uint64_t counter = 0;
+    vector<tIndexEntry> entries;
+
+    // Adds a packet at the given offset, opens a new entry every stride packets
+    void add(uint64_t offset, uint64_t timestamp) {
+        if (counter++ % stride == 0) {
+            entries.push_back(tIndexEntry());
+            entries.back().offset = offset;
+            entries.back().mintime = timestamp;
+            entries.back().maxtime = timestamp;
+            return;
+        }
+        tIndexEntry &entry = entries.back();
+        if (timestamp < entry.mintime) entry.mintime = timestamp;
+        if (timestamp > entry.maxtime) entry.maxtime = timestamp;
+    }
+
+    // Finds entries which may hold packets from the interval [tbegin,tend)
+    bool window(uint64_t tbegin, uint64_t tend, size_t &first, size_t &last) const {
+        first = 0;
+        while (first < entries.size() && entries[first].maxtime < tbegin) first++;
+        last = entries.size();
+        while (last > first && entries[last-1].mintime >= tend) last--;
+        return first < last;
+    }
+
+    // Checks that offsets of the entries grow and stay within the limit
+    bool valid(uint64_t limit) const {
+        for (size_t idx = 0; idx < entries.size(); idx++) {
+            if (entries[idx].offset > limit) return false;
+            if (idx > 0 && entries[idx].offset < entries[idx-1].offset) return false;
+        }
+        return true;
+    }
+
+    // Loads a sidecar index, accepted only if it describes data of the given
+    // size, its entries fill the file and their offsets are valid
+    bool load(const string &filename, uint64_t datasize, uint64_t limit) {
+        ifstream file(filename, ifstream::binary | ifstream::ate);
+        if (!file) return false;
+        uint64_t filesize = file.tellg();
+        file.seekg(0);
+
+        tIndexHeader header;
+        if (!file.read((char *) &header, sizeof(header))) return false;
+        if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0) return false;
+        if (header.version != INDEX_VERSION || header.datasize != datasize) return false;
+        if (header.hdrsize < sizeof(header) || header.hdrsize > filesize) return false;
+        if ((filesize - header.hdrsize) % sizeof(tIndexEntry) != 0) return false;
+        if ((filesize - header.hdrsize) / sizeof(tIndexEntry) != header.entries) return false;
+
+        file.seekg(header.hdrsize);
+        entries.resize(header.entries);
+        if (!file.read((char *) entries.data(), entries.size() * sizeof(tIndexEntry)) || !valid(limit)) {
+            entries.clear();
+            return false;
+        }
+        stride = header.stride;
+        return true;
+    }
+
+    bool save(const string &filename, uint64_t datasize) const {
+        ofstream file(filename, ofstream::binary);
+        if (!file) return false;
+
+        tIndexHeader header;
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.stride = stride;
+        header.datasize = datasize;
+        header.entries = entries.size();
+
+        file.write((const char *) &header, sizeof(header));
+        file.write((const char *) entries.data(), entries.size() * sizeof(tIndexEntry));
+        return (bool) file;
+    }
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef TRACE_MERGE_H_
+#define TRACE_MERGE_H_
+
+#include <queue>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <functional>
+
+#include "trace.h"
+
+using namespace std;
+
+// Input of a merged trace, timestamps are moved by the shift; rebased inputs
+// start the shift after the first packet of the primary inputs. Of every
+// den packets num are taken, the first packet of the input always.
+// The merge ends with its last primary input.
+struct tMergeInput {
+    tTrace *trace = nullptr;
+    int64_t shift = 0;
+    bool rebase = false;
+    bool primary = true;
+    unsigned num = 1;
+    unsigned den = 1;
+};
+
+// Merges packets of several traces in time order (k-way merge by a heap),
+// packets with equal timestamps are taken from inputs added earlier first.
+// Only IPv4 packets are merged. Packets of inputs which are not rebased are
+// dropped within the offset from the start of the primary inputs.
+class tTraceMerge : public tTrace {
+    public:
+        uint64_t offset = 0;
+
+        void add(const tMergeInput &input);
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        virtual void stats(ostream &out);
+        uint64_t start() const { return _start; }
+        ~tTraceMerge();
+
+    private:
+        struct tSource {
+            tMergeInput input;
+            tBatch batch;
+            size_t position = 0;
+            unsigned sampl = 0;
+            bool started = false;
+            uint64_t first = 0;
+            tPacket pkt;
+        };
+
+        typedef pair<uint64_t,unsigned> tHeapItem;
+
+        vector<tSource> _sources;
+        priority_queue<tHeapItem, vector<tHeapItem>, greater<tHeapItem>> _heap;
+        unsigned _primaries = 0;
+        uint64_t _origin = 0;
+        uint64_t _start = 0;
+        uint64_t _begin = 0;
+        bool _primed = false;
+
+        bool _fetch(unsigned idx);
+        void _push(unsigned idx);
+        void _prime();
+        inline bool _next(tPacket &pkt);
+};
+
+tTraceMerge::~tTraceMerge() {
+    for (tSource &src: _sources) delete src.input.trace;
+}
+
+void tTraceMerge::add(const tMergeInput &input) {
+    _sources.push_back(tSource());
+    _sources.back().input = input;
+    _sources.back().sampl = input.den;
+    if (input.primary) _primaries++;
+}
+
+// Reads the next sampled packet of the input, in its original time
+bool tTraceMerge::_fetch(unsigned idx) {
+    tSource &src = _sources[idx];
+    while (true) {
+        while (src.position >= src.batch.count) {
+            if (!src.input.trace->nextBatch(src.batch)) {
+                if (src.input.primary) _primaries--;
+                return false;
+            }
+            src.position = 0;
+        }
+        src.pkt = src.batch[src.position++];
+        if (src.pkt.ipver != 4) continue; // TODO: IPv6 support
+
+        if (!src.started) {
+            src.started = true;
+            src.first = src.pkt.timestamp;
+            return true;
+        }
+
+        if (src.sampl == 0) src.sampl = src.input.den;
+        if (--src.sampl >= src.input.num) continue;
+        return true;
+    }
+}
+
+void tTraceMerge::_push(unsigned idx) {
+    tSource &src = _sources[idx];
+    uint64_t timestamp = src.pkt.timestamp + src.input.shift;
+    if (src.input.rebase) timestamp += _origin - src.first;
+    src.pkt.timestamp = timestamp;
+    _heap.push(tHeapItem(timestamp, idx));
+}
+
+// Reads the first packets of all inputs, the primary ones set the origin
+// and the start of the merged trace
+void tTraceMerge::_prime() {
+    _primed = true;
+    bool primaries = _primaries > 0;
+
+    vector<bool> ready(_sources.size());
+    for (unsigned idx = 0; idx < _sources.size(); idx++) {
+        ready[idx] = _fetch(idx);
+        if (!ready[idx] || !_sources[idx].input.primary) continue;
+        if (_origin == 0 || _sources[idx].first < _origin) _origin = _sources[idx].first;
+        uint64_t first = _sources[idx].first + _sources[idx].input.shift;
+        if (_start == 0 || first < _start) _start = first;
+    }
+
+    // Without primary inputs the merge runs until all inputs end
+    if (!primaries) _primaries = 1;
+
+    for (unsigned idx = 0; idx < _sources.size(); idx++)
+        if (ready[idx]) _push(idx);
+
+    // Jump over the offset time in indexed inputs
+    if (offset > 0 && _start != 0) {
+        _begin = _start + offset;
+        seek(_begin);
+    }
+}
+
+inline bool tTraceMerge::_next(tPacket &pkt) {
+    while (!_heap.empty() && _primaries > 0) {
+        unsigned idx = _heap.top().second;
+        _heap.pop();
+        pkt = _sources[idx].pkt;
+        if (_fetch(idx)) _push(idx);
+        if (pkt.timestamp < _begin && !_sources[idx].input.rebase) continue;
+        return true;
+    }
+    return false;
+}
+
+bool tTraceMerge::nextPacket(tPacket &pkt) {
+    if (!_primed) _prime();
+    return _next(pkt);
+}
+
+bool tTraceMerge::nextBatch(tBatch &batch) {
+    if (!_primed) _prime();
+
+    _batch.resize(TRACE_BATCH);
+    size_t count = 0;
+    while (count < _batch.size() && _next(_batch[count])) count++;
+    batch.packets = _batch.data();
+    batch.count = count;
+    return count > 0;
+}
+
+// Seeks all inputs with their own time, rebased inputs are left as they are;
+// packets already taken from the inputs stay, so nothing is reported skipped
+bool tTraceMerge::seek(uint64_t tbegin, uint64_t tend) {
+    for (tSource &src: _sources) {
+        if (src.input.rebase) continue;
+        uint64_t sbegin = tbegin - src.input.shift;
+        uint64_t send = (tend == ~0UL) ? tend : tend - src.input.shift;
+        if (src.input.trace->seek(sbegin, send)) src.position = src.batch.count;
+    }
+    return false;
+}
+
+void tTraceMerge::stats(ostream &out) {
+    for (tSource &src: _sources) src.input.trace->stats(out);
+}
+
+// Reads traces one after another, each one is opened when the previous one
+// ends; seeks apply to the current trace and all the following ones
+class tTraceChain : public tTrace {
+    public:
+        typedef function<tTrace *(unsigned)> tOpen;
+
+        tTraceChain(unsigned count, const tOpen &open) : _count(count), _open(open) {};
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        virtual void stats(ostream &out);
+
+    private:
+        unsigned _count;
+        tOpen _open;
+        unsigned _next = 0;
+        unique_ptr<tTrace> _trace;
+        bool _seeking = false;
+        uint64_t _tbegin = 0;
+        uint64_t _tend = ~0UL;
+        ostringstream _stats;
+
+        bool _advance();
+};
+
+// Closes the current trace and opens the next one, false after the last one
+bool tTraceChain::_advance() {
+    if (_trace) _trace->stats(_stats);
+    _trace.reset();
+    if (_next >= _count) return false;
+    _trace.reset(_open(_next++));
+    if (_seeking) _trace->seek(_tbegin, _tend);
+    return true;
+}
+
+bool tTraceChain::nextPacket(tPacket &pkt) {
+    while (!_trace || !_trace->nextPacket(pkt)) {
+        if (!_advance()) return false;
+    }
+    return true;
+}
+
+bool tTraceChain::nextBatch(tBatch &batch) {
+    while (!_trace || !_trace->nextBatch(batch)) {
+        if (!_advance()) return false;
+    }
+    return true;
+}
+
+bool tTraceChain::seek(uint64_t tbegin, uint64_t tend) {
+    _seeking = true;
+    _tbegin = tbegin;
+    _tend = tend;
+    return _trace ? _trace->seek(tbegin, tend) : false;
+}
+
+// Statistics of the closed traces, then of the current one
+void tTraceChain::stats(ostream &out) {
+    out << _stats.str();
+    _stats.str("");
+    if (_trace) _trace->stats(out);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TRACE_OPEN_H_
+#define TRACE_OPEN_H_
+
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "trace-pcap.h"
+#include "trace-compact.h"
+
+using namespace std;
+
+// Opens a trace source according the format of the file
+tTrace *openTrace(const char *filename, bool origdata = false) {
+    if (origdata) {
+        if (tPcapFile::probe(filename))
+            return new tTracePcap(filename);
+#ifndef NOPCAP
+        return new tTraceFile(filename);
+#else
+        throw runtime_error("Unsupported capture file format (compiled without PCAP support)!");
+#endif
+    }
+
+    // Pipes and devices can not be mapped nor probed, they are read as a PDAT stream
+    struct stat st;
+    if (stat(filename, &st) == 0 && !S_ISREG(st.st_mode))
+        return new tTraceData(filename);
+
+    if (tTraceCompact::probe(filename))
+        return new tTraceCompact(filename);
+    return new tTraceMmap(filename);
+}
+
+#endif
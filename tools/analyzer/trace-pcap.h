@@ -0,0 +1,376 @@
+#ifndef TRACE_PCAP_H_
+#define TRACE_PCAP_H_
+
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+using namespace std;
+
+// Magic numbers of classic pcap files (microsecond and nanosecond variant)
+const uint32_t PCAP_MAGIC_USEC = 0xA1B2C3D4;
+const uint32_t PCAP_MAGIC_NSEC = 0xA1B23C4D;
+
+// Block types and byte-order magic of pcapng files
+const uint32_t PCAPNG_SHB = 0x0A0D0D0A;
+const uint32_t PCAPNG_IDB = 0x00000001;
+const uint32_t PCAPNG_OPB = 0x00000002;
+const uint32_t PCAPNG_SPB = 0x00000003;
+const uint32_t PCAPNG_EPB = 0x00000006;
+const uint32_t PCAPNG_BOM = 0x1A2B3C4D;
+const uint16_t PCAPNG_OPT_TSRESOL = 9;
+
+// Highest timestamp resolutions whose units fit 64 bits (binary, decimal)
+const unsigned PCAPNG_TSRESOL_BINARY = 63;
+const unsigned PCAPNG_TSRESOL_DECIMAL = 19;
+
+struct __attribute__ ((packed)) tPcapHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct __attribute__ ((packed)) tPcapRecord {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+// Capturing interface, classic pcap files have just one
+struct tPcapInterface {
+    tPacketParser parser;
+    bool swapped = false;
+    bool tsbinary = false;
+    unsigned tsexp = 6;
+
+    // Converts timestamp in interface units to microseconds
+    inline uint64_t usec(uint64_t ts) const {
+        if (tsbinary) {
+            // Fractions finer than 2^-32 s are dropped, so that they do not overflow
+            unsigned exp = min(tsexp, 32U);
+            ts >>= tsexp - exp;
+            return (ts >> exp) * 1000000 + (((ts & ((1UL << exp) - 1)) * 1000000) >> exp);
+        }
+        uint64_t scale = 1;
+        if (tsexp >= 6) {
+            for (unsigned i = 6; i < tsexp; i++) scale *= 10;
+            return ts / scale;
+        }
+        for (unsigned i = tsexp; i < 6; i++) scale *= 10;
+        return ts * scale;
+    }
+};
+
+// Reference to a packet record of the file
+struct tPcapRef {
+    size_t offset;
+    uint32_t iface;
+};
+
+// Memory mapped pcap or pcapng file, records are located first and then
+// parsed, so that ranges of records can be handled by different threads
+class tPcapFile {
+    public:
+        tPcapFile(const char *filename);
+        ~tPcapFile();
+        static bool probe(const char *filename);
+        bool nextRecord(tPcapRef &ref);
+        void scan(vector<tPcapRef> &records);
+        inline bool parse(const tPcapRef &ref, tPacket &pkt) const;
+        uint64_t parse(const vector<tPcapRef> &records, size_t first, size_t last, vector<tPacket> &packets) const;
+        void release(size_t offset);
+
+    private:
+        int _fd = -1;
+        const unsigned char *_data = nullptr;
+        size_t _size = 0;
+        size_t _offset = 0;
+        size_t _released = 0;
+        bool _ng = false;
+        bool _swapped = false;
+        uint32_t _section = 0;
+        vector<tPcapInterface> _interfaces;
+
+        inline uint32_t _u32(size_t offset, bool swapped) const {
+            uint32_t value;
+            memcpy(&value, _data + offset, sizeof(value));
+            return swapped ? __bswap_32(value) : value;
+        }
+
+        inline uint16_t _u16(size_t offset, bool swapped) const {
+            uint16_t value;
+            memcpy(&value, _data + offset, sizeof(value));
+            return swapped ? __bswap_16(value) : value;
+        }
+
+        void _openSection(size_t offset);
+        void _addInterface(size_t offset, size_t length);
+};
+
+tPcapFile::tPcapFile(const char *filename) {
+    _fd = open(filename, O_RDONLY);
+    if (_fd < 0) throw runtime_error("Opening file for reading failed!");
+
+    struct stat st;
+    if (fstat(_fd, &st) < 0 || (size_t) st.st_size < sizeof(tPcapHeader)) {
+        close(_fd);
+        throw runtime_error("Reading pcap header failed!");
+    }
+
+    _size = st.st_size;
+    void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (data == MAP_FAILED) {
+        close(_fd);
+        throw runtime_error("Mapping file into memory failed!");
+    }
+    _data = (const unsigned char *) data;
+    madvise(data, _size, MADV_SEQUENTIAL);
+
+    uint32_t magic = _u32(0, false);
+    if (magic == PCAPNG_SHB) {
+        _ng = true;
+        try {
+            _openSection(0);
+        } catch (...) {
+            munmap(data, _size);
+            close(_fd);
+            throw;
+        }
+        return;
+    }
+
+    tPcapInterface iface;
+    iface.swapped = magic == __bswap_32(PCAP_MAGIC_USEC) || magic == __bswap_32(PCAP_MAGIC_NSEC);
+    magic = iface.swapped ? __bswap_32(magic) : magic;
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+        munmap(data, _size);
+        close(_fd);
+        throw runtime_error("Unknown pcap file format!");
+    }
+
+    iface.tsexp = (magic == PCAP_MAGIC_NSEC) ? 9 : 6;
+    iface.parser.linktype = _u32(offsetof(tPcapHeader, linktype), iface.swapped) & 0xFFFF;
+    _interfaces.push_back(iface);
+    _offset = sizeof(tPcapHeader);
+}
+
+tPcapFile::~tPcapFile() {
+    if (_data) munmap((void *) _data, _size);
+    if (_fd >= 0) close(_fd);
+}
+
+// Checks whether the file is a pcap or pcapng file
+bool tPcapFile::probe(const char *filename) {
+    uint32_t magic;
+    ifstream file(filename, ifstream::binary);
+    if (!file.read((char *) &magic, sizeof(magic))) return false;
+    return magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+        magic == __bswap_32(PCAP_MAGIC_USEC) || magic == __bswap_32(PCAP_MAGIC_NSEC) ||
+        magic == PCAPNG_SHB;
+}
+
+// Starts a new pcapng section, interface numbering restarts within it
+void tPcapFile::_openSection(size_t offset) {
+    if (offset + 12 > _size) throw runtime_error("truncated dump file");
+    uint32_t bom = _u32(offset + 8, false);
+    if (bom != PCAPNG_BOM && bom != __bswap_32(PCAPNG_BOM))
+        throw runtime_error("Unknown pcapng byte order!");
+    _swapped = bom != PCAPNG_BOM;
+    _section = _interfaces.size();
+}
+
+void tPcapFile::_addInterface(size_t offset, size_t length) {
+    tPcapInterface iface;
+    iface.swapped = _swapped;
+    iface.parser.linktype = _u16(offset + 8, _swapped);
+
+    // Walk options for the timestamp resolution
+    size_t end = offset + length - 4;
+    for (size_t opt = offset + 16; opt + 4 <= end; ) {
+        uint16_t code = _u16(opt, _swapped);
+        uint16_t len = _u16(opt + 2, _swapped);
+        if (code == 0) break;
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1 && opt + 5 <= end) {
+            iface.tsbinary = _data[opt + 4] & 0x80;
+            iface.tsexp = _data[opt + 4] & 0x7F;
+            if (iface.tsexp > (iface.tsbinary ? PCAPNG_TSRESOL_BINARY : PCAPNG_TSRESOL_DECIMAL))
+                throw runtime_error("Unsupported pcapng timestamp resolution!");
+        }
+        opt += 4 + ((len + 3) & ~3U);
+    }
+    _interfaces.push_back(iface);
+}
+
+// Moves to the next packet record, handles other blocks on the way
+bool tPcapFile::nextRecord(tPcapRef &ref) {
+    if (!_ng) {
+        if (_offset + sizeof(tPcapRecord) > _size) {
+            if (_offset != _size) throw runtime_error("truncated dump file");
+            return false;
+        }
+        size_t next = _offset + sizeof(tPcapRecord) + _u32(_offset + offsetof(tPcapRecord, caplen), _interfaces[0].swapped);
+        if (next > _size) throw runtime_error("truncated dump file");
+        ref.offset = _offset;
+        ref.iface = 0;
+        _offset = next;
+        return true;
+    }
+
+    while (_offset + 12 <= _size) {
+        uint32_t type = _u32(_offset, _swapped);
+        if (type == PCAPNG_SHB) _openSection(_offset);
+
+        size_t length = _u32(_offset + 4, _swapped);
+        if (length < 12 || _offset + length > _size) throw runtime_error("truncated dump file");
+        if ((type == PCAPNG_IDB && length < 20) || (type == PCAPNG_SPB && length < 16) ||
+            ((type == PCAPNG_EPB || type == PCAPNG_OPB) && length < 32))
+            throw runtime_error("Damaged pcapng block!");
+
+        size_t offset = _offset;
+        _offset += length;
+
+        if (type == PCAPNG_IDB) {
+            _addInterface(offset, length);
+        } else if (type == PCAPNG_EPB || type == PCAPNG_OPB || type == PCAPNG_SPB) {
+            uint32_t iface = 0;
+            if (type == PCAPNG_EPB) iface = _u32(offset + 8, _swapped);
+            if (type == PCAPNG_OPB) iface = _u16(offset + 8, _swapped);
+            if (_section + iface >= _interfaces.size()) throw runtime_error("Unknown pcapng interface!");
+            ref.offset = offset;
+            ref.iface = _section + iface;
+            return true;
+        }
+    }
+    if (_offset != _size) throw runtime_error("truncated dump file");
+    return false;
+}
+
+// Finds all packet records of the file
+void tPcapFile::scan(vector<tPcapRef> &records) {
+    tPcapRef ref;
+    while (nextRecord(ref)) records.push_back(ref);
+}
+
+// Parses a single packet record, returns false for damaged packets; block
+// lengths were checked by nextRecord()
+inline bool tPcapFile::parse(const tPcapRef &ref, tPacket &pkt) const {
+    const tPcapInterface &iface = _interfaces[ref.iface];
+    size_t offset = ref.offset;
+    uint64_t timestamp = 0;
+    uint32_t caplen, len;
+
+    if (!_ng) {
+        timestamp = (uint64_t) _u32(offset, iface.swapped) * 1000000 +
+            iface.usec(_u32(offset + offsetof(tPcapRecord, ts_frac), iface.swapped));
+        caplen = _u32(offset + offsetof(tPcapRecord, caplen), iface.swapped);
+        len = _u32(offset + offsetof(tPcapRecord, len), iface.swapped);
+        offset += sizeof(tPcapRecord);
+    } else {
+        uint32_t type = _u32(offset, iface.swapped);
+        uint32_t length = _u32(offset + 4, iface.swapped);
+        if (type == PCAPNG_SPB) {
+            len = _u32(offset + 8, iface.swapped);
+            caplen = min<uint32_t>(len, length - 16);
+            offset += 12;
+        } else {
+            timestamp = iface.usec(((uint64_t) _u32(offset + 12, iface.swapped) << 32) | _u32(offset + 16, iface.swapped));
+            caplen = _u32(offset + 20, iface.swapped);
+            len = _u32(offset + 24, iface.swapped);
+            if (caplen > length - 32) return false;
+            offset += 28;
+        }
+    }
+
+    if (!iface.parser.parsePacket(pkt, _data + offset, caplen)) return false;
+    pkt.timestamp = timestamp;
+    pkt.length = len;
+    return true;
+}
+
+// Parses records [first,last) into packets, returns number of damaged packets
+uint64_t tPcapFile::parse(const vector<tPcapRef> &records, size_t first, size_t last, vector<tPacket> &packets) const {
+    packets.reserve(packets.size() + last - first);
+
+    tPacket pkt;
+    uint64_t damaged = 0;
+    for (size_t r = first; r < last; r++) {
+        if (!parse(records[r], pkt)) {
+            damaged++;
+            continue;
+        }
+        packets.push_back(pkt);
+    }
+    return damaged;
+}
+
+// Drops pages of the mapping before the offset, they are not needed anymore
+void tPcapFile::release(size_t offset) {
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    offset &= ~(pagesize - 1);
+    if (offset <= _released + TRACE_READAHEAD) return;
+    madvise((char *) _data + _released, offset - _released, MADV_DONTNEED);
+    _released = offset;
+}
+
+// Native reader of pcap and pcapng files, packets are parsed in batches
+class tTracePcap : public tTrace {
+    public:
+        tTracePcap(const char *filename) : _pcap(filename) {};
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual void stats(ostream &out);
+        uint64_t damaged() const { return _damaged; }
+
+    private:
+        tPcapFile _pcap;
+        size_t _position = 0;
+        size_t _count = 0;
+        uint64_t _damaged = 0;
+};
+
+bool tTracePcap::nextBatch(tBatch &batch) {
+    _batch.resize(TRACE_BATCH);
+
+    tPcapRef ref = {0, 0};
+    size_t count = 0;
+    while (count < TRACE_BATCH && _pcap.nextRecord(ref)) {
+        if (_pcap.parse(ref, _batch[count])) count++;
+        else _damaged++;
+    }
+    _pcap.release(ref.offset);
+
+    batch.packets = _batch.data();
+    batch.count = count;
+    _position = _count = count;
+    return count > 0;
+}
+
+bool tTracePcap::nextPacket(tPacket &pkt) {
+    if (_position >= _count) {
+        tBatch batch;
+        if (!nextBatch(batch)) return false;
+        _position = 0;
+    }
+    pkt = _batch[_position++];
+    return true;
+}
+
+void tTracePcap::stats(ostream &out) {
+    if (_damaged > 0) out << _damaged << " packets damaged, skipped." << endl;
+}
+
+#endif
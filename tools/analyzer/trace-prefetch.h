@@ -0,0 +1,154 @@
+#ifndef TRACE_PREFETCH_H_
+#define TRACE_PREFETCH_H_
+
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+
+#include "trace.h"
+
+using namespace std;
+
+const size_t PREFETCH_SLOTS = 4;
+
+// Read-ahead adapter of any trace source, batches are read into a ring
+// of slots by a background thread while the consumer works on the
+// previous one
+class tTracePrefetch : public tTrace {
+    public:
+        tTracePrefetch(tTrace *source, size_t slots = PREFETCH_SLOTS);
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        virtual void stats(ostream &out);
+        ~tTracePrefetch();
+
+    private:
+        unique_ptr<tTrace> _source;
+        vector<vector<tPacket>> _slots;
+        size_t _head = 0;
+        size_t _tail = 0;
+        size_t _filled = 0;
+        size_t _position = 0;
+        bool _consuming = false;
+        bool _reading = false;
+        bool _paused = false;
+        bool _eof = false;
+        bool _stop = false;
+        exception_ptr _error;
+        mutex _mutex;
+        condition_variable _cond;
+        thread _thread;
+
+        void _run();
+};
+
+tTracePrefetch::tTracePrefetch(tTrace *source, size_t slots) : _source(source), _slots(max<size_t>(slots, 2)) {
+    _thread = thread(&tTracePrefetch::_run, this);
+}
+
+tTracePrefetch::~tTracePrefetch() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+}
+
+// Background reader, fills free slots of the ring until the source ends
+void tTracePrefetch::_run() {
+    unique_lock<mutex> lock(_mutex);
+    while (true) {
+        _cond.wait(lock, [this] { return _stop || (!_eof && !_paused && _filled < _slots.size()); });
+        if (_stop) return;
+
+        vector<tPacket> &slot = _slots[_tail];
+        _reading = true;
+        lock.unlock();
+
+        bool more = false;
+        try {
+            tBatch batch;
+            if ((more = _source->nextBatch(batch)))
+                slot.assign(batch.begin(), batch.end());
+        } catch (...) {
+            lock.lock();
+            _error = current_exception();
+            more = false;
+            lock.unlock();
+        }
+
+        lock.lock();
+        _reading = false;
+        if (more) {
+            _tail = (_tail + 1) % _slots.size();
+            _filled++;
+        } else {
+            _eof = true;
+        }
+        _cond.notify_all();
+    }
+}
+
+bool tTracePrefetch::nextBatch(tBatch &batch) {
+    unique_lock<mutex> lock(_mutex);
+    if (_consuming) {
+        _head = (_head + 1) % _slots.size();
+        _filled--;
+        _consuming = false;
+        _cond.notify_all();
+    }
+
+    _cond.wait(lock, [this] { return _filled > 0 || _eof; });
+    if (_filled == 0) {
+        if (_error) rethrow_exception(_error);
+        return false;
+    }
+
+    _consuming = true;
+    batch.packets = _slots[_head].data();
+    batch.count = _slots[_head].size();
+    _position = 0;
+    return true;
+}
+
+bool tTracePrefetch::nextPacket(tPacket &pkt) {
+    if (!_consuming || _position >= _slots[_head].size()) {
+        tBatch batch;
+        if (!nextBatch(batch)) return false;
+    }
+    pkt = _slots[_head][_position++];
+    return true;
+}
+
+// Seeks the source while the reader is paused, batches already read ahead
+// are dropped only when the source skipped over them
+bool tTracePrefetch::seek(uint64_t tbegin, uint64_t tend) {
+    unique_lock<mutex> lock(_mutex);
+    _paused = true;
+    _cond.wait(lock, [this] { return !_reading; });
+
+    bool skipped = _source->seek(tbegin, tend);
+    if (skipped) {
+        _filled = _consuming ? 1 : 0;
+        _tail = (_head + _filled) % _slots.size();
+        _position = _consuming ? _slots[_head].size() : 0;
+    }
+
+    _paused = false;
+    _cond.notify_all();
+    return skipped;
+}
+
+// Statistics of the source, taken between its reads
+void tTracePrefetch::stats(ostream &out) {
+    unique_lock<mutex> lock(_mutex);
+    _cond.wait(lock, [this] { return !_reading; });
+    _source->stats(out);
+}
+
+#endif
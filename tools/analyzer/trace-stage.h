@@ -0,0 +1,228 @@
+#ifndef TRACE_STAGE_H_
+#define TRACE_STAGE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ostream>
+#include <exception>
+
+#include "trace.h"
+#include "utils.h"
+
+using namespace std;
+
+const size_t STAGE_SLOTS = 8;
+const size_t STAGE_LINE = 64;
+
+// Bounded lock-free ring of a single producer and a single consumer, the
+// producer fills back() and publishes it by push(), the consumer reads
+// front() and releases it by pop(); both sides cache the index of the
+// other one to touch its cache line only when the ring looks full or empty
+template<typename T>
+class tSpscRing {
+    public:
+        tSpscRing(size_t slots);
+        inline T *back();
+        inline void push();
+        inline T *front();
+        inline void pop();
+        inline void truncate(size_t keep);
+
+    private:
+        // Consumer and producer indices are kept a cache line apart
+        vector<T> _slots;
+        size_t _mask;
+        char _pad0[STAGE_LINE];
+        atomic<size_t> _head;
+        size_t _tailcache = 0;
+        char _pad1[STAGE_LINE];
+        atomic<size_t> _tail;
+        size_t _headcache = 0;
+        char _pad2[STAGE_LINE];
+};
+
+template<typename T>
+tSpscRing<T>::tSpscRing(size_t slots) : _head(0), _tail(0) {
+    size_t size = 2;
+    while (size < slots) size <<= 1;
+    _slots.resize(size);
+    _mask = size - 1;
+}
+
+template<typename T>
+inline T *tSpscRing<T>::back() {
+    size_t tail = _tail.load(memory_order_relaxed);
+    if (tail - _headcache == _slots.size()) {
+        _headcache = _head.load(memory_order_acquire);
+        if (tail - _headcache == _slots.size()) return nullptr;
+    }
+    return &_slots[tail & _mask];
+}
+
+template<typename T>
+inline void tSpscRing<T>::push() {
+    _tail.store(_tail.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+template<typename T>
+inline T *tSpscRing<T>::front() {
+    size_t head = _head.load(memory_order_relaxed);
+    if (head == _tailcache) {
+        _tailcache = _tail.load(memory_order_acquire);
+        if (head == _tailcache) return nullptr;
+    }
+    return &_slots[head & _mask];
+}
+
+template<typename T>
+inline void tSpscRing<T>::pop() {
+    _head.store(_head.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// Drops all but the first slots, only while the producer is stopped
+template<typename T>
+inline void tSpscRing<T>::truncate(size_t keep) {
+    size_t head = _head.load(memory_order_acquire);
+    size_t tail = _tail.load(memory_order_acquire);
+    _tailcache = min(tail, head + keep);
+    _tail.store(_tailcache, memory_order_release);
+}
+
+// Pipeline stage running a trace source in its own thread, optionally
+// pinned to a core, batches are passed on by a lock-free ring. Stalls count
+// the waits for a free slot (the consumer is slower) and for a filled one
+// (the source is slower).
+class tTraceStage : public tTrace {
+    public:
+        tTraceStage(tTrace *source, const string &name, size_t slots = STAGE_SLOTS, int cpu = -1);
+        virtual bool nextPacket(tPacket &pkt);
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        virtual void stats(ostream &out);
+        ~tTraceStage();
+
+    private:
+        unique_ptr<tTrace> _source;
+        string _name;
+        int _cpu;
+        tSpscRing<vector<tPacket>> _ring;
+        bool _consuming = false;
+        size_t _position = 0;
+        atomic<bool> _eof;
+        atomic<bool> _stop;
+        exception_ptr _error;
+        thread _thread;
+
+        uint64_t _batches = 0;
+        atomic<uint64_t> _fullstalls;
+        uint64_t _emptystalls = 0;
+
+        void _start();
+        void _halt();
+        void _run();
+};
+
+tTraceStage::tTraceStage(tTrace *source, const string &name, size_t slots, int cpu) :
+        _source(source), _name(name), _cpu(cpu), _ring(slots), _eof(false), _stop(false), _fullstalls(0) {
+    _start();
+}
+
+tTraceStage::~tTraceStage() {
+    _halt();
+}
+
+void tTraceStage::_start() {
+    _stop.store(false);
+    _thread = thread(&tTraceStage::_run, this);
+    if (_cpu >= 0) pinThread(_thread.native_handle(), _cpu);
+}
+
+void tTraceStage::_halt() {
+    _stop.store(true);
+    if (_thread.joinable()) _thread.join();
+}
+
+// Producer, copies batches of the source into free slots until it ends
+void tTraceStage::_run() {
+    vector<tPacket> *slot;
+    try {
+        while (!_stop.load(memory_order_relaxed)) {
+            if ((slot = _ring.back()) == nullptr) {
+                _fullstalls.fetch_add(1, memory_order_relaxed);
+                while ((slot = _ring.back()) == nullptr) {
+                    if (_stop.load(memory_order_relaxed)) return;
+                    this_thread::yield();
+                }
+            }
+
+            tBatch batch;
+            if (!_source->nextBatch(batch)) break;
+            slot->assign(batch.begin(), batch.end());
+            _ring.push();
+        }
+    } catch (...) {
+        _error = current_exception();
+    }
+    _eof.store(true, memory_order_release);
+}
+
+bool tTraceStage::nextBatch(tBatch &batch) {
+    if (_consuming) {
+        _ring.pop();
+        _consuming = false;
+    }
+
+    vector<tPacket> *slot = _ring.front();
+    if (slot == nullptr) {
+        _emptystalls++;
+        while ((slot = _ring.front()) == nullptr) {
+            if (_eof.load(memory_order_acquire) && (slot = _ring.front()) == nullptr) {
+                if (_error) rethrow_exception(_error);
+                return false;
+            }
+            this_thread::yield();
+        }
+    }
+
+    _consuming = true;
+    _batches++;
+    batch.packets = slot->data();
+    batch.count = slot->size();
+    _position = 0;
+    return true;
+}
+
+bool tTraceStage::nextPacket(tPacket &pkt) {
+    if (!_consuming || _position >= _ring.front()->size()) {
+        tBatch batch;
+        if (!nextBatch(batch)) return false;
+    }
+    pkt = (*_ring.front())[_position++];
+    return true;
+}
+
+// Seeks the source while the producer is stopped, batches already passed
+// on are dropped only when the source skipped over them
+bool tTraceStage::seek(uint64_t tbegin, uint64_t tend) {
+    _halt();
+    bool skipped = _source->seek(tbegin, tend);
+    if (skipped) {
+        _ring.truncate(_consuming ? 1 : 0);
+        _position = _consuming ? _ring.front()->size() : 0;
+    }
+    if (_error) rethrow_exception(_error);
+    _eof.store(false);
+    _start();
+    return skipped;
+}
+
+void tTraceStage::stats(ostream &out) {
+    out << "stage-" << _name << ": " << _batches << " batches, " << _fullstalls.load() << " full stalls, ";
+    out << _emptystalls << " empty stalls" << endl;
+    _source->stats(out);
+}
+
+#endif
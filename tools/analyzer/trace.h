@@ -2,9 +2,16 @@
 #define TRACE_H_
 
 #include <string>
+#include <vector>
+#include <memory>
 #include <cstring>
 #include <fstream>
+#include <iostream>
 #include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
@@ -12,48 +19,112 @@
 #include <netinet/ether.h>
 
 #include "model.h"
+#include "output.h"
+#include "trace-index.h"
 
 using namespace std;
 
+extern const char *__progname;
+
+// Number of packets returned by a single nextBatch call
+const size_t TRACE_BATCH = 4096;
+
+// Read-ahead window of memory mapped traces (in bytes)
+const size_t TRACE_READAHEAD = 64UL << 20;
+
+// Span of consecutive packets, valid until the next call on its source
+struct tBatch {
+    const tPacket *packets = nullptr;
+    size_t count = 0;
+
+    const tPacket *begin() const { return packets; }
+    const tPacket *end() const { return packets + count; }
+    const tPacket &operator[](size_t idx) const { return packets[idx]; }
+};
+
 class tTrace {
     public:
         virtual bool nextPacket(tPacket &pkt) = 0;
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        virtual void stats(ostream &) {}
         virtual ~tTrace() {};
+
+    protected:
+        vector<tPacket> _batch;
 };
 
+// Generic batching, copies packets one by one through nextPacket
+bool tTrace::nextBatch(tBatch &batch) {
+    _batch.resize(TRACE_BATCH);
+    size_t count = 0;
+    while (count < _batch.size() && nextPacket(_batch[count])) count++;
+    batch.packets = _batch.data();
+    batch.count = count;
+    return count > 0;
+}
+
+// Jumps forward to the packets of the interval [tbegin,tend) and stops
+// reading after it, only if the source is indexed; returns true when
+// the rest of the current batch was skipped
+bool tTrace::seek(uint64_t, uint64_t) {
+    return false;
+}
+
 class tTraceData : public tTrace {
     public:
-        tTraceData(const char *filename, bool write = false, bool csv = false);
+        tTraceData(const char *filename, bool write = false, bool csv = false, bool direct = false);
         virtual bool nextPacket(tPacket &pkt);
         bool savePacket(const tPacket &pkt);
+        void finish();
         ~tTraceData();
 
     private:
         ifstream _ifile;
-        ofstream _ofile;
+        unique_ptr<tOutput> _output;
+        string _filename;
+        tTraceIndex _index;
         uint64_t _counter = 0;
         bool _write = false;
         bool _csv = false;
+        bool _indexed = false;
 };
 
-tTraceData::tTraceData(const char *filename, bool write, bool csv) {
+tTraceData::tTraceData(const char *filename, bool write, bool csv, bool direct) : _filename(filename) {
     if ((_write = write)) {
-        _ofile.open(filename, (_csv = csv) ? ios_base::out : ofstream::binary);
-        if (!_ofile) throw runtime_error("Opening file for writing failed!");
+        _csv = csv;
+        _output.reset(new tOutput(filename, direct));
+        // The sidecar index only makes sense next to a regular PDAT file
+        struct stat st;
+        _indexed = !csv && stat(filename, &st) == 0 && S_ISREG(st.st_mode);
     } else {
         _ifile.open(filename, ifstream::binary);
-        if (!_ofile) throw runtime_error("Opening file for reading failed!");
+        if (!_ifile) throw runtime_error("Opening file for reading failed!");
     }
 }
 
 tTraceData::~tTraceData() {
     if (_write) {
-        _ofile.close();
+        // Errors can not be reported from here, writers call finish() first
+        try {
+            finish();
+        } catch (...) {
+        }
     } else {
         _ifile.close();
     }
 }
 
+// Writes out the buffered packets and the time index of the file
+void tTraceData::finish() {
+    if (!_output) return;
+    unique_ptr<tOutput> output(move(_output));
+    output->close();
+    // The data is complete without the index, readers just scan instead of seeking
+    if (_indexed && !_index.save(_filename + INDEX_SUFFIX, _counter * sizeof(tPacket)))
+        cerr << __progname << ": warning: writing index " << _filename << INDEX_SUFFIX << " failed" << endl;
+}
+
 bool tTraceData::nextPacket(tPacket &pkt) {
     _ifile.read((char*) &pkt, sizeof(tPacket));
     if (!_ifile) return false;
@@ -63,86 +134,180 @@ bool tTraceData::nextPacket(tPacket &pkt) {
 
 bool tTraceData::savePacket(const tPacket &pkt) {
     if (_csv) {
-        _ofile << pkt.srcPrefix.str(false) << ","; // SrcIP
-        _ofile << "0.0.0.0" << ","; // DstIP
-        _ofile << "0" << ","; // Protocol
-        _ofile << "0" << ","; // SrcPort
-        _ofile << "0" << endl; // DstPort
-        if (!_ofile) return false;
+        static const char rest[] = ",0.0.0.0,0,0,0\n"; // DstIP, Protocol, SrcPort, DstPort
+        char *line = _output->reserve(32);
+        char *end = pkt.srcPrefix.put(line, false); // SrcIP
+        memcpy(end, rest, sizeof(rest) - 1);
+        _output->commit(end - line + sizeof(rest) - 1);
         _counter++;
         return true;
     }
 
-    _ofile.write((const char*) &pkt, sizeof(tPacket));
-    if (!_ofile) return false;
+    _output->write(&pkt, sizeof(tPacket));
+    if (_indexed) _index.add(_counter, pkt.timestamp);
     _counter++;
     return true;
 }
 
-#ifndef NOPCAP
-#include <pcap/pcap.h>
-
-class tTraceFile : public tTrace {
+// Zero-copy reader of PDAT files, packets are served directly from the mapping
+class tTraceMmap : public tTrace {
     public:
-        tTraceFile(const char *filename);
+        tTraceMmap(const char *filename);
         virtual bool nextPacket(tPacket &pkt);
-        ~tTraceFile();
+        virtual bool nextBatch(tBatch &batch);
+        virtual bool seek(uint64_t tbegin, uint64_t tend = ~0UL);
+        ~tTraceMmap();
 
     private:
-        uint64_t _counter = 0;
-        pcap_t *_pcap = nullptr;
-        int _linktype = DLT_NULL;
-        inline bool _parsePacket(tPacket &pkt, const unsigned char *data, unsigned len);
-        inline bool _parseEthernet(tPacket &pkt, const unsigned char *data, unsigned len);
-        inline bool _parseVlan(tPacket &pkt, const unsigned char *data, unsigned len);
-        inline bool _parseIPv4(tPacket &pkt, const unsigned char *data, unsigned len);
-        inline bool _parseIPv6(tPacket &pkt, const unsigned char *data, unsigned len);
+        int _fd = -1;
+        const tPacket *_data = nullptr;
+        tTraceIndex _index;
+        size_t _size = 0;
+        size_t _count = 0;
+        size_t _position = 0;
+        size_t _advised = 0;
+        size_t _released = 0;
+        inline void _readahead();
 };
 
-tTraceFile::tTraceFile(const char *filename) {
-    char errbuff[PCAP_ERRBUF_SIZE];
-    _pcap = pcap_open_offline(filename, errbuff);
-    if (!_pcap) throw runtime_error(errbuff);
-    _linktype = pcap_datalink(_pcap);
+tTraceMmap::tTraceMmap(const char *filename) {
+    _fd = open(filename, O_RDONLY);
+    if (_fd < 0) throw runtime_error("Opening file for reading failed!");
+
+    struct stat st;
+    if (fstat(_fd, &st) < 0) {
+        close(_fd);
+        throw runtime_error("Reading file status failed!");
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(_fd);
+        throw runtime_error("Mapping of other than regular files is not supported!");
+    }
+
+    _size = st.st_size;
+    _count = _size / sizeof(tPacket);
+    if (_size == 0) return;
+    _index.load(string(filename) + INDEX_SUFFIX, _size, _count);
+
+    void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (data == MAP_FAILED) {
+        close(_fd);
+        throw runtime_error("Mapping file into memory failed!");
+    }
+
+    _data = (const tPacket *) data;
+    madvise(data, _size, MADV_SEQUENTIAL);
+    _readahead();
 }
 
-tTraceFile::~tTraceFile() {
-    if (_pcap) pcap_close(_pcap);
+tTraceMmap::~tTraceMmap() {
+    if (_data) munmap((void *) _data, _size);
+    if (_fd >= 0) close(_fd);
 }
 
-bool tTraceFile::nextPacket(tPacket &pkt) {
-    struct pcap_pkthdr *pkthdr;
-    const unsigned char *pktdata;
-    while (true) {
-        int retval = pcap_next_ex(_pcap, &pkthdr, &pktdata);
-        if (retval == -2) return false;
-        if (retval <= 0) throw runtime_error(pcap_geterr(_pcap));
+// Keeps the kernel one window ahead of the reader and drops pages behind it
+inline void tTraceMmap::_readahead() {
+    size_t offset = _position * sizeof(tPacket);
+    if (offset + TRACE_READAHEAD / 2 < _advised || _advised >= _size) return;
 
-        _counter++;
-        if (!_parsePacket(pkt, pktdata, pkthdr->caplen)) {
-            cout << "packet no. " << _counter << " damaged, skipping!" << endl;
-            //throw runtime_error("packet parsing failed");
-            continue;
-        }
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+    char *base = (char *) _data;
 
-        pkt.timestamp = 1000000*pkthdr->ts.tv_sec + pkthdr->ts.tv_usec;
-        pkt.length = pkthdr->len; // TODO: která vrstva
+    size_t begin = _advised & ~(pagesize - 1);
+    _advised = min(offset + TRACE_READAHEAD, _size);
+    madvise(base + begin, _advised - begin, MADV_WILLNEED);
+
+    size_t end = offset & ~(pagesize - 1);
+    if (end > _released) {
+        madvise(base + _released, end - _released, MADV_DONTNEED);
+        _released = end;
+    }
+}
+
+bool tTraceMmap::nextPacket(tPacket &pkt) {
+    if (_position >= _count) return false;
+    pkt = _data[_position++];
+    if ((_position & (TRACE_BATCH - 1)) == 0) _readahead();
+    return true;
+}
+
+bool tTraceMmap::seek(uint64_t tbegin, uint64_t tend) {
+    if (_index.entries.empty()) return false;
+
+    size_t first, last;
+    if (!_index.window(tbegin, tend, first, last)) {
+        _count = _position;
         return true;
     }
+
+    if (last < _index.entries.size())
+        _count = min<size_t>(_count, _index.entries[last].offset);
+    if (_index.entries[first].offset <= _position) return false;
+
+    _position = min<size_t>(_index.entries[first].offset, _count);
+    _advised = _position * sizeof(tPacket);
+    _readahead();
+    return true;
+}
+
+bool tTraceMmap::nextBatch(tBatch &batch) {
+    if (_position >= _count) return false;
+    _readahead();
+    batch.packets = _data + _position;
+    batch.count = min(TRACE_BATCH, _count - _position);
+    _position += batch.count;
+    return batch.count > 0;
 }
 
-inline bool tTraceFile::_parsePacket(tPacket &pkt, const unsigned char *data, unsigned len) {
-    if (_linktype == DLT_EN10MB) return _parseEthernet(pkt, data, len);
-    else if (_linktype == DLT_RAW) {
-        if (!len) { return false; }
-        if (*data >> 4 == 4) return _parseIPv4(pkt, data, len);
-        if (*data >> 4 == 6) return _parseIPv6(pkt, data, len);
-        return false;
+// Link-layer types of capture files (LINKTYPE_* values of the pcap format)
+const int LINKTYPE_NULL = 0;
+const int LINKTYPE_ETHERNET = 1;
+const int LINKTYPE_RAW = 101;
+// Raw IP files of libpcap versions which stored the DLT_RAW value itself
+const int LINKTYPE_RAW_BSD = 12;
+const int LINKTYPE_RAW_OPENBSD = 14;
+const int LINKTYPE_IPV4 = 228;
+const int LINKTYPE_IPV6 = 229;
+
+struct vlan_header {
+    uint16_t id;
+    uint16_t ether_type;
+} __attribute__((__packed__));
+
+#define VLAN_HLEN sizeof(struct vlan_header)
+
+// Extracts packet fields from the captured link-layer frame
+class tPacketParser {
+    public:
+        int linktype = LINKTYPE_NULL;
+        inline bool parsePacket(tPacket &pkt, const unsigned char *data, unsigned len) const;
+
+    private:
+        inline bool _parseEthernet(tPacket &pkt, const unsigned char *data, unsigned len) const;
+        inline bool _parseVlan(tPacket &pkt, const unsigned char *data, unsigned len) const;
+        inline bool _parseIPv4(tPacket &pkt, const unsigned char *data, unsigned len) const;
+        inline bool _parseIPv6(tPacket &pkt, const unsigned char *data, unsigned len) const;
+};
+
+inline bool tPacketParser::parsePacket(tPacket &pkt, const unsigned char *data, unsigned len) const {
+    switch (linktype) {
+        case LINKTYPE_ETHERNET:
+            return _parseEthernet(pkt, data, len);
+        case LINKTYPE_RAW:
+        case LINKTYPE_RAW_BSD:
+        case LINKTYPE_RAW_OPENBSD:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            if (!len) return false;
+            if (*data >> 4 == 4) return _parseIPv4(pkt, data, len);
+            if (*data >> 4 == 6) return _parseIPv6(pkt, data, len);
+            return false;
+        default:
+            return false;
     }
-    return false;
 }
 
-inline bool tTraceFile::_parseEthernet(tPacket &pkt, const unsigned char *data, unsigned len) {
+inline bool tPacketParser::_parseEthernet(tPacket &pkt, const unsigned char *data, unsigned len) const {
     if (len < ETH_HLEN) return false;
     struct ether_header *ether = (struct ether_header *) data;
     data += ETH_HLEN; len -= ETH_HLEN;
@@ -158,14 +323,7 @@ inline bool tTraceFile::_parseEthernet(tPacket &pkt, const unsigned char *data,
     }
 }
 
-struct vlan_header {
-    uint16_t id;
-    uint16_t ether_type;
-} __attribute__((__packed__));
-
-#define VLAN_HLEN sizeof(struct vlan_header)
-
-inline bool tTraceFile::_parseVlan(tPacket &pkt, const unsigned char *data, unsigned len) {
+inline bool tPacketParser::_parseVlan(tPacket &pkt, const unsigned char *data, unsigned len) const {
     while (len >= VLAN_HLEN) {
         struct vlan_header *vlan = (struct vlan_header *) data;
         data += VLAN_HLEN; len -= VLAN_HLEN;
@@ -183,7 +341,7 @@ inline bool tTraceFile::_parseVlan(tPacket &pkt, const unsigned char *data, unsi
     return false;
 }
 
-inline bool tTraceFile::_parseIPv4(tPacket &pkt, const unsigned char *data, unsigned len) {
+inline bool tPacketParser::_parseIPv4(tPacket &pkt, const unsigned char *data, unsigned len) const {
     if (!len) return false;
     struct ip *ip_header = (struct ip *) data;
     if (ip_header->ip_v != 4) { return false; }
@@ -196,7 +354,7 @@ inline bool tTraceFile::_parseIPv4(tPacket &pkt, const unsigned char *data, unsi
     return true;
 }
 
-inline bool tTraceFile::_parseIPv6(tPacket &pkt, const unsigned char *data, unsigned len) {
+inline bool tPacketParser::_parseIPv6(tPacket &pkt, const unsigned char *data, unsigned len) const {
     const unsigned IP6_HLEN = 40;
     if (len < IP6_HLEN) { return false; }
     struct ip6_hdr *ip_header = (struct ip6_hdr *) data;
@@ -208,6 +366,60 @@ inline bool tTraceFile::_parseIPv6(tPacket &pkt, const unsigned char *data, unsi
     return true;
 }
 
+#ifndef NOPCAP
+#include <pcap/pcap.h>
+
+class tTraceFile : public tTrace {
+    public:
+        tTraceFile(const char *filename);
+        virtual bool nextPacket(tPacket &pkt);
+        virtual void stats(ostream &out);
+        uint64_t damaged() const { return _damaged; }
+        ~tTraceFile();
+
+    private:
+        uint64_t _counter = 0;
+        uint64_t _damaged = 0;
+        pcap_t *_pcap = nullptr;
+        tPacketParser _parser;
+};
+
+tTraceFile::tTraceFile(const char *filename) {
+    char errbuff[PCAP_ERRBUF_SIZE];
+    _pcap = pcap_open_offline(filename, errbuff);
+    if (!_pcap) throw runtime_error(errbuff);
+    int datalink = pcap_datalink(_pcap);
+    _parser.linktype = (datalink == DLT_RAW) ? LINKTYPE_RAW : datalink;
+}
+
+tTraceFile::~tTraceFile() {
+    if (_pcap) pcap_close(_pcap);
+}
+
+bool tTraceFile::nextPacket(tPacket &pkt) {
+    struct pcap_pkthdr *pkthdr;
+    const unsigned char *pktdata;
+    while (true) {
+        int retval = pcap_next_ex(_pcap, &pkthdr, &pktdata);
+        if (retval == -2) return false;
+        if (retval <= 0) throw runtime_error(pcap_geterr(_pcap));
+
+        _counter++;
+        if (!_parser.parsePacket(pkt, pktdata, pkthdr->caplen)) {
+            _damaged++;
+            continue;
+        }
+
+        pkt.timestamp = 1000000*pkthdr->ts.tv_sec + pkthdr->ts.tv_usec;
+        pkt.length = pkthdr->len; // TODO: která vrstva
+        return true;
+    }
+}
+
+void tTraceFile::stats(ostream &out) {
+    if (_damaged > 0) out << _damaged << " packets damaged, skipped." << endl;
+}
+
 #endif // NOPCAP
 
-#endif
\ No newline at end of file
+#endif
@@ -4,7 +4,10 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <cstdint>
 #include <algorithm>
+#include <pthread.h>
+#include <sched.h>
 
 using namespace std;
 
@@ -17,6 +20,34 @@ string strfrmt(const string& format, Args ... args) {
     return string(buf.get(), buf.get() + size - 1);
 }
 
+// Formats a decimal number without allocations, returns the end of the text
+inline char *putDecimal(char *out, uint64_t value) {
+    char digits[20];
+    unsigned count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (count > 0) *out++ = digits[--count];
+    return out;
+}
+
+// Formats an IPv4 address (host byte order) in dotted notation
+inline char *putIPv4(char *out, unsigned addr) {
+    out = putDecimal(out, addr >> 24); *out++ = '.';
+    out = putDecimal(out, (addr >> 16) & 0xFF); *out++ = '.';
+    out = putDecimal(out, (addr >> 8) & 0xFF); *out++ = '.';
+    return putDecimal(out, addr & 0xFF);
+}
+
+// Restricts the thread to the core, returns false when it is not possible
+inline bool pinThread(pthread_t thr, int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(thr, sizeof(cpus), &cpus) == 0;
+}
+
 // Flips a pair A,B to B,A pair
 // Credits: https://stackoverflow.com/questions/5056645/sorting-stdmap-using-value
 template<typename A, typename B>
@@ -9,6 +9,7 @@
 #include <stdexcept>
 
 #include "../analyzer/model.h"
+#include "../analyzer/report.h"
 
 using namespace std;
 
@@ -34,10 +35,11 @@ struct tArgs {
     bool sum = false;
     bool newinvalidation = true;
     bool collapseacc = false;
+    const char *eventfile = nullptr;
 };
 
 inline void tArgs::usage() {
-    cout << "Usage: " << __progname << " [-hSHr] [-x RPLEN] [-a ATIMEOUT] [-s SPEED] [-t THRESHOLD] COUNTER_FILES ..." << endl;
+    cout << "Usage: " << __progname << " [-hSHr] [-x RPLEN] [-a ATIMEOUT] [-s SPEED] [-t THRESHOLD] [-W EVENTFILE] COUNTER_FILES ..." << endl;
     cout << "  -h            Show this help message." << endl;
     cout << "  -H            Print pure heavy-hitters too." << endl;
     cout << "  -r            Report all changes in the prefix tree structure." << endl;
@@ -46,11 +48,12 @@ inline void tArgs::usage() {
     cout << "  -a ATIMEOUT   Active timeout in usec (for periodic reports)." << endl;
     cout << "  -s SPEED      Set threshold according the speed (in bytes per second)." << endl;
     cout << "  -t THRESHOLD  Manual threshold settings for heavy hitter detection (in bytes)." << endl;
+    cout << "  -W EVENTFILE  Write events as binary records to the file instead of text." << endl;
 }
 
 tArgs::tArgs(int argc, char * const argv[]) {
 
-    for (int opt = 0; (opt = getopt(argc, argv, ":hHSrx:a:t:s:")) != -1; ) switch(opt) {
+    for (int opt = 0; (opt = getopt(argc, argv, ":hHSrx:a:t:s:W:")) != -1; ) switch(opt) {
         case 'h':
             help = true; return;
         case 'H':
@@ -75,6 +78,8 @@ tArgs::tArgs(int argc, char * const argv[]) {
             threshold = strtoul(optarg, nullptr, 10); break;
         case 's':
             speed = strtoul(optarg, nullptr, 10); break;
+        case 'W':
+            eventfile = optarg; break;
 
         case '?': throw runtime_error(string() + "unknown option '-" + (char) optopt + "'");
         case ':': throw runtime_error(string() + "missing argument for option '-" + (char) optopt + "'");
@@ -101,10 +106,11 @@ int main(int argc, char *argv[]) try {
     if (args.speed > 0)
         args.threshold = args.speed * args.atimeout / 1000000;
 
+    tReport report(cout, args.eventfile ? REPORT_BINARY : REPORT_TEXT, args.eventfile);
     map<tPrefix,tNodeOffline> tree;
 
     for (unsigned f = 0; f < args.filecount; f++) {
-        cout << "filename: " << args.filenames[f] << endl;
+        report.text() << "filename: " << args.filenames[f] << endl;
 
         ifstream infile(args.filenames[f]);
         for (string line; getline(infile, line);) {
@@ -157,14 +163,14 @@ int main(int argc, char *argv[]) try {
         // Hierarchy heavy-hitters list
         for (auto it = tree.begin(); it != tree.end(); it++) {
             if (!it->second.hhh) continue;
-            cout << "timestamp: " << f << ", hhh: 1, prefix: " << it->first.str() << ", value: " << it->second.hhhvalue << endl;
+            report.event(f, EVENT_WINDOW_HHH, it->first, it->second.hhhvalue);
         }
 
         // Heavy-hitters list
         if (args.pureheavy) {
             for (auto it = tree.begin(); it != tree.end(); it++) {
                 if (!it->second.hh) continue;
-                cout << "timestamp: " << f << ", hhh: 0, prefix: " << it->first.str() << ", value: " << it->second.hhvalue << endl;
+                report.event(f, EVENT_WINDOW_HH, it->first, it->second.hhvalue);
             }
         }
 
@@ -172,7 +178,7 @@ int main(int argc, char *argv[]) try {
         if (args.reports) {
             for (auto it = tree.begin(); it != tree.end(); it++) {
                 if (it->first.length != 32) continue;
-                cout << "timestamp," << f << ",report,prefix," << it->first.str() << ",value," << it->second.hhvalue << endl;
+                report.event(f, EVENT_COUNTER, it->first, it->second.hhvalue);
             }
         }
 